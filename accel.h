@@ -0,0 +1,124 @@
+#ifndef ACCEL_H
+#define ACCEL_H
+
+/*
+   Pointer acceleration curves.
+
+   A curve maps pointer speed, in device counts per millisecond, to a gain applied on top of the DPI scale.
+   Curves are only evaluated while building a lookup table at startup (so they may use pow() and friends),
+   the hot path turns a frame's movement and duration into a table index with integer arithmetic and reads the scale from it.
+*/
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+	ACCEL_PROFILE_FLAT,      // Constant gain of 1, only the DPI scale applies
+	ACCEL_PROFILE_LINEAR,    // 1 + factor * (speed - offset)
+	ACCEL_PROFILE_POWER,     // 1 + factor * (speed - offset)^exponent
+	ACCEL_PROFILE_PIECEWISE, // Linear interpolation between user-defined (speed, gain) points
+	NUM_ACCEL_PROFILES,
+} accel_profile_t;
+
+static const char* const accel_profile_names[NUM_ACCEL_PROFILES] = { "flat", "linear", "power", "piecewise" };
+
+typedef struct {
+	double speed; // Counts per millisecond
+	double gain;
+} accel_point_t;
+
+typedef struct {
+	accel_profile_t profile;
+	double offset;   // Speed below which the linear and power curves keep a gain of 1
+	double factor;
+	double exponent; // Power curve only
+	double max_gain; // Upper bound on the gain, 0 for none
+	const accel_point_t* points; // Piecewise curve only, sorted by speed
+	size_t num_points;
+} accel_curve_t;
+
+#define ACCEL_SPEED_SCALE  16   // Table entries per count/ms
+#define ACCEL_TABLE_SIZE   1024 // Covers up to 64 counts/ms, faster movement uses the last entry
+#define ACCEL_IDLE_US      100000 // Movement after this long idle has no meaningful speed, assume the default interval
+#define ACCEL_DEFAULT_INTERVAL_US 1000 // One report at the G502's 1000 Hz polling rate
+
+typedef struct {
+	int64_t scale[ACCEL_TABLE_SIZE]; // Base scale multiplied by the gain at each speed
+} accel_table_t;
+
+static inline double accel_curve_gain(const accel_curve_t* curve, double speed) {
+	double gain = 1.0;
+	double over = speed > curve->offset ? speed - curve->offset : 0.0;
+	switch (curve->profile) {
+	case ACCEL_PROFILE_FLAT:
+		break;
+	case ACCEL_PROFILE_LINEAR:
+		gain = 1.0 + curve->factor * over;
+		break;
+	case ACCEL_PROFILE_POWER:
+		gain = 1.0 + curve->factor * pow(over, curve->exponent);
+		break;
+	case ACCEL_PROFILE_PIECEWISE:
+		if (curve->num_points == 0) {
+			break;
+		}
+		gain = curve->points[curve->num_points - 1].gain;
+		if (speed <= curve->points[0].speed) {
+			gain = curve->points[0].gain;
+			break;
+		}
+		for (size_t i = 1; i < curve->num_points; i++) {
+			const accel_point_t* lo = &curve->points[i - 1];
+			const accel_point_t* hi = &curve->points[i];
+			if (speed <= hi->speed) {
+				double t = hi->speed > lo->speed ? (speed - lo->speed) / (hi->speed - lo->speed) : 1.0;
+				gain = lo->gain + t * (hi->gain - lo->gain);
+				break;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+	if (curve->max_gain > 0 && gain > curve->max_gain) {
+		gain = curve->max_gain;
+	}
+	return gain < 0 ? 0 : gain;
+}
+
+// Precompute the scale for every table speed, `base_scale` is the fixed-point scale at a gain of 1
+static inline void accel_table_build(accel_table_t* table, const accel_curve_t* curve, int64_t base_scale) {
+	for (size_t i = 0; i < ACCEL_TABLE_SIZE; i++) {
+		double speed = (double)i / ACCEL_SPEED_SCALE;
+		table->scale[i] = llround(base_scale * accel_curve_gain(curve, speed));
+	}
+}
+
+// Look up the scale for a frame that moved (dx, dy) counts over `interval_us`, no floating point or sqrt
+static inline int64_t accel_table_scale(const accel_table_t* table, int32_t dx, int32_t dy, uint64_t interval_us) {
+	uint64_t ax = dx < 0 ? -(int64_t)dx : dx;
+	uint64_t ay = dy < 0 ? -(int64_t)dy : dy;
+	uint64_t hi = ax > ay ? ax : ay;
+	uint64_t lo = ax > ay ? ay : ax;
+	// Alpha max plus beta min approximation of the distance (hi + 3/8 lo), within 7% of the true length, in eighths of a count
+	uint64_t distance_8 = 8 * hi + 3 * lo;
+	uint64_t index = distance_8 * ACCEL_SPEED_SCALE * 1000 / (8 * interval_us);
+	if (index >= ACCEL_TABLE_SIZE) {
+		index = ACCEL_TABLE_SIZE - 1;
+	}
+	return table->scale[index];
+}
+
+// Parse a profile name, returns -1 if unknown
+static inline int accel_profile_from_name(const char* name) {
+	for (int i = 0; i < NUM_ACCEL_PROFILES; i++) {
+		if (strcmp(name, accel_profile_names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+#endif // ACCEL_H
@@ -0,0 +1,97 @@
+/*
+   Self-check that scaled mouse movement never drifts from the exact product of the input and the scale.
+
+   Random deltas of both signs are fed through the daemon's own scale_rel_motion(), once with the compile-time
+   DPI_SCALE_NUM and once with the scales of an input_tables_t built from a runtime dpi_scale with acceleration,
+   where the scale changes with the speed of every event. Either way the output in fixed point plus the remainder left
+   in the accumulator must equal the sum of every delta times its scale exactly, and the remainder stays within half a pixel.
+
+   Build with `./build.sh bench` and run `./bench/dpi_drift_test [events]` (10 million by default), it exits non-zero on drift.
+*/
+
+#define main g502d_main
+#include "../g502d.c"
+#undef main
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*, deterministic so a failure reproduces
+static uint64_t rng_next(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+// Mostly the small deltas of ordinary movement, with the odd large one of a fast flick
+static int32_t random_delta(void) {
+	uint64_t r = rng_next();
+	int32_t magnitude = (r & 0xff) < 8 ? (int32_t)((r >> 8) % 2000) : (int32_t)((r >> 8) % 128);
+	return (r >> 63) ? -magnitude : magnitude;
+}
+
+// Returns the number of failures, `tables` NULL scales every delta by DPI_SCALE_NUM
+static int check_drift(const char* name, const input_tables_t* tables, uint64_t count) {
+	const int64_t one = (int64_t)1 << DPI_SCALE_SHIFT;
+	int64_t accum = 0;
+	int64_t sum_in_scaled = 0;
+	int64_t sum_out = 0;
+	int64_t max_remainder = 0;
+	for (uint64_t i = 0; i < count; i++) {
+		int32_t value = random_delta();
+		int64_t scale = DPI_SCALE_NUM;
+		if (tables) {
+			// Intervals from 8000 Hz to 125 Hz reports, so the whole acceleration table is used
+			uint64_t interval_us = 125 + rng_next() % 7876;
+			scale = accel_table_scale(&tables->accel, value, (int32_t)(rng_next() % 64) - 32, interval_us);
+		}
+		sum_in_scaled += (int64_t)value * scale;
+		sum_out += scale_rel_motion(&accum, value, scale);
+		int64_t remainder = accum < 0 ? -accum : accum;
+		if (remainder > max_remainder) {
+			max_remainder = remainder;
+		}
+	}
+
+	int failures = 0;
+	if (sum_out * one + accum != sum_in_scaled) {
+		fprintf(stderr, "%s: drifted, output %" PRId64 " * 2^%d + remainder %" PRId64 " != %" PRId64 "\n",
+			name, sum_out, DPI_SCALE_SHIFT, accum, sum_in_scaled);
+		failures++;
+	}
+	if (max_remainder > one / 2) {
+		fprintf(stderr, "%s: remainder reached %" PRId64 "/%" PRId64 " of a pixel\n", name, max_remainder, one);
+		failures++;
+	}
+	printf("%-24s %" PRIu64 " deltas, output %" PRId64 " px, remainder %" PRId64 "/%" PRId64 " px: %s\n",
+		name, count, sum_out, accum, one, failures ? "FAIL" : "ok");
+	return failures;
+}
+
+int main(int argc, char** argv) {
+	uint64_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+	if (count == 0) {
+		fprintf(stderr, "Usage: %s [events]\n", argv[0]);
+		return 1;
+	}
+
+	int failures = check_drift("DPI_SCALE_NUM", NULL, count);
+
+	// A runtime scale that is not a power of two, folded into a table with a gain that changes with speed
+	config_set_defaults(&daemon_config);
+	daemon_config.dpi_scale = 0.37;
+	accel_profile_override = ACCEL_PROFILE_LINEAR;
+	input_tables_t* tables = build_input_tables(&daemon_config);
+	if (!tables) {
+		return 1;
+	}
+	int64_t base_scale = llround(daemon_config.dpi_scale * (1 << DPI_SCALE_SHIFT));
+	if (tables->accel.scale[0] != base_scale) {
+		fprintf(stderr, "dpi_scale: table scale at a gain of 1 is %" PRId64 ", expected %" PRId64 "\n", tables->accel.scale[0], base_scale);
+		failures++;
+	}
+	failures += check_drift("dpi_scale 0.37 + linear", tables, count);
+	free(tables);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,181 @@
+/*
+   Microbenchmark comparing the lock-free keyboard queue against the original kb_event_buffer design
+   (mutex protected ring buffer with a sem_getvalue/sem_post per event and a sem_wait per event).
+
+   Two producers (standing in for the keyboard INPUT and mouse IO threads) push events stamped with CLOCK_MONOTONIC,
+   a single consumer (standing in for the keyboard OUTPUT thread) pops them and records the producer-to-consumer latency.
+
+   Build with `./build.sh bench` and run `./bench/kb_queue_bench [events per producer] [interval us]`.
+   An interval of 0 floods the queue to measure throughput instead of wakeup latency.
+*/
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kb_queue.h"
+
+#define NUM_PRODUCERS 2
+#define BUFFER_SIZE (1<<18)
+
+static long events_per_producer = 200000;
+static long interval_us = 20;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void stamp_event(struct input_event* ev, long i) {
+	uint64_t t = now_ns();
+	ev->time.tv_sec = t / 1000000000ull;
+	ev->time.tv_usec = (t % 1000000000ull) / 1000; // Microseconds as in evdev, nanoseconds are kept in value below
+	ev->type = EV_KEY;
+	ev->code = KEY_A + (i & 15);
+	ev->value = (int)(t % 1000);
+}
+
+static uint64_t event_time_ns(const struct input_event* ev) {
+	return (uint64_t)ev->time.tv_sec * 1000000000ull + (uint64_t)ev->time.tv_usec * 1000ull + (uint64_t)ev->value;
+}
+
+static void pace(long i) {
+	if (interval_us > 0 && (i & 3) == 3) {
+		usleep(interval_us);
+	}
+}
+
+// Original design
+static sem_t legacy_sem;
+static pthread_mutex_t legacy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct input_event legacy_buffer[BUFFER_SIZE];
+static size_t legacy_head = 0;
+static size_t legacy_tail = 0;
+
+// Both designs yield and retry when full, so flooding measures throughput rather than exiting like the daemon does
+static void legacy_push(struct input_event* ev) {
+	for (;;) {
+		pthread_mutex_lock(&legacy_mutex);
+		size_t next_head = (legacy_head + 1) % BUFFER_SIZE;
+		int sem_value;
+		sem_getvalue(&legacy_sem, &sem_value);
+		if (next_head != legacy_tail) {
+			legacy_buffer[legacy_head] = *ev;
+			legacy_head = next_head;
+			pthread_mutex_unlock(&legacy_mutex);
+			break;
+		}
+		pthread_mutex_unlock(&legacy_mutex);
+		sched_yield();
+	}
+	sem_post(&legacy_sem);
+}
+
+static void legacy_pop(struct input_event* ev) {
+	sem_wait(&legacy_sem);
+	size_t current_tail = atomic_load(&legacy_tail);
+	*ev = legacy_buffer[current_tail];
+	atomic_store(&legacy_tail, (current_tail + 1) % BUFFER_SIZE);
+}
+
+// Lock-free design with futex wakeups, as used by g502d
+static kb_queue_slot_t mpsc_buffer[BUFFER_SIZE];
+static kb_queue_t mpsc_queue;
+
+static void mpsc_push(struct input_event* ev) {
+	while (!kb_queue_push(&mpsc_queue, ev, 0)) {
+		sched_yield();
+	}
+	kb_queue_wake_consumer(&mpsc_queue);
+}
+
+static void mpsc_pop(struct input_event* ev) {
+	uint32_t source;
+	while (!kb_queue_pop(&mpsc_queue, ev, &source)) {
+		kb_queue_wait_nonempty(&mpsc_queue);
+	}
+}
+
+typedef struct {
+	const char* name;
+	void (*push)(struct input_event* ev);
+	void (*pop)(struct input_event* ev);
+} queue_impl_t;
+
+static void* producer_func(void* impl_void) {
+	queue_impl_t* impl = impl_void;
+	for (long i = 0; i < events_per_producer; i++) {
+		struct input_event ev;
+		stamp_event(&ev, i);
+		impl->push(&ev);
+		pace(i);
+	}
+	return NULL;
+}
+
+static int compare_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void run(queue_impl_t* impl) {
+	long total = events_per_producer * NUM_PRODUCERS;
+	uint64_t* latencies = malloc(sizeof(uint64_t) * total);
+	if (!latencies) {
+		fprintf(stderr, "Failed to allocate latency samples\n");
+		exit(1);
+	}
+
+	pthread_t producers[NUM_PRODUCERS];
+	uint64_t start = now_ns();
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		pthread_create(&producers[i], NULL, producer_func, impl);
+	}
+	for (long i = 0; i < total; i++) {
+		struct input_event ev;
+		impl->pop(&ev);
+		latencies[i] = now_ns() - event_time_ns(&ev);
+	}
+	uint64_t elapsed = now_ns() - start;
+	for (int i = 0; i < NUM_PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+
+	qsort(latencies, total, sizeof(uint64_t), compare_u64);
+	printf("%-8s %10.0f ev/s  p50 %7.2f us  p99 %7.2f us  p99.9 %7.2f us  max %8.2f us\n",
+		impl->name,
+		total / (elapsed / 1e9),
+		latencies[total / 2] / 1e3,
+		latencies[total * 99 / 100] / 1e3,
+		latencies[total * 999 / 1000] / 1e3,
+		latencies[total - 1] / 1e3);
+	free(latencies);
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) events_per_producer = atol(argv[1]);
+	if (argc > 2) interval_us = atol(argv[2]);
+	if (events_per_producer <= 0 || interval_us < 0) {
+		fprintf(stderr, "Usage: %s [events per producer] [interval us]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%d producers x %ld events, %ld us pause every 4 events\n", NUM_PRODUCERS, events_per_producer, interval_us);
+
+	sem_init(&legacy_sem, 0, 0);
+	queue_impl_t legacy = { "legacy", legacy_push, legacy_pop };
+	run(&legacy);
+	sem_destroy(&legacy_sem);
+
+	kb_queue_init(&mpsc_queue, mpsc_buffer, BUFFER_SIZE);
+	queue_impl_t mpsc = { "mpsc", mpsc_push, mpsc_pop };
+	run(&mpsc);
+
+	return 0;
+}
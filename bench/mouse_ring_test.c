@@ -0,0 +1,139 @@
+/*
+   Self-check of the mouse processing against known frames, without any devices or /dev/uinput.
+
+   The frames are written to an in-memory ring which the daemon's own mouse_thread_io_func() reads through a ring source
+   (see event_io.h), remapping and scaling them with the compiled-in defaults from config.h into a ring sink standing in
+   for the virtual G502. Side buttons remapped to keys go through the keyboard event buffer, which is read back directly.
+   Both outputs are compared against what the defaults should produce.
+
+   Build with `./build.sh bench` and run `./bench/mouse_ring_test`, it exits non-zero on any difference.
+*/
+
+#define main g502d_main
+#include "../g502d.c"
+#undef main
+
+#define RING_SIZE 64
+
+typedef struct {
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+} expected_event_t;
+
+static const expected_event_t mouse_input[] = {
+	// Movement is halved by DPI_SCALE, 1.5 rounds up and -2 keeps the half pixel for later
+	{ EV_REL, REL_X, 3 }, { EV_REL, REL_Y, -4 }, { EV_SYN, SYN_REPORT, 0 },
+	// The half pixel left over cancels this one out, the frame still goes out
+	{ EV_REL, REL_X, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_MSC, MSC_SCAN, 0x90001 }, { EV_KEY, BTN_LEFT, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	// Side buttons turn into modifiers on the keyboard, their scan codes follow them
+	{ EV_MSC, MSC_SCAN, 0x90004 }, { EV_KEY, BTN_SIDE, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_REL, REL_X, 2 }, { EV_MSC, MSC_SCAN, 0x90004 }, { EV_KEY, BTN_SIDE, 0 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_MSC, MSC_SCAN, 0x90001 }, { EV_KEY, BTN_LEFT, 0 }, { EV_SYN, SYN_REPORT, 0 },
+};
+
+static const expected_event_t expected_mouse[] = {
+	{ EV_REL, REL_X, 2 }, { EV_REL, REL_Y, -2 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_SYN, SYN_REPORT, 0 },
+	{ EV_MSC, MSC_SCAN, 0x90001 }, { EV_KEY, BTN_LEFT, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_SYN, SYN_REPORT, 0 },
+	{ EV_REL, REL_X, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_MSC, MSC_SCAN, 0x90001 }, { EV_KEY, BTN_LEFT, 0 }, { EV_SYN, SYN_REPORT, 0 },
+};
+
+static const expected_event_t expected_keyboard[] = {
+	{ EV_MSC, MSC_SCAN, 0x70004 }, { EV_KEY, KEY_LEFTSHIFT, 1 }, { EV_SYN, SYN_REPORT, 0 },
+	{ EV_MSC, MSC_SCAN, 0x70004 }, { EV_KEY, KEY_LEFTSHIFT, 0 }, { EV_SYN, SYN_REPORT, 0 },
+};
+
+// Returns the number of mismatches
+static int compare(const char* name, const struct input_event* actual, size_t actual_count, const expected_event_t* expected, size_t expected_count) {
+	int failures = 0;
+	for (size_t i = 0; i < actual_count || i < expected_count; i++) {
+		const struct input_event* a = i < actual_count ? &actual[i] : NULL;
+		const expected_event_t* e = i < expected_count ? &expected[i] : NULL;
+		if (a && e && a->type == e->type && a->code == e->code && a->value == e->value) {
+			continue;
+		}
+		fprintf(stderr, "%s event %zu: got ", name, i);
+		if (a) {
+			fprintf(stderr, "type=%d code=%d value=%d", a->type, a->code, a->value);
+		} else {
+			fprintf(stderr, "nothing");
+		}
+		fprintf(stderr, ", expected ");
+		if (e) {
+			fprintf(stderr, "type=%d code=%d value=%d\n", e->type, e->code, e->value);
+		} else {
+			fprintf(stderr, "nothing\n");
+		}
+		failures++;
+	}
+	printf("%-8s %zu events: %s\n", name, actual_count, failures ? "FAIL" : "ok");
+	return failures;
+}
+
+int main(void) {
+	config_set_defaults(&daemon_config);
+	atomic_store(&active_input_tables, build_input_tables(&daemon_config));
+	if (!atomic_load(&active_input_tables)) {
+		return 1;
+	}
+	kb_queue_init(&kb_event_queue, kb_event_buffer, EVENT_BUFFER_SIZE);
+
+	// Fake mouse, one report a millisecond
+	static struct input_event input_events[RING_SIZE];
+	event_ring_t input_ring;
+	event_ring_init(&input_ring, input_events, RING_SIZE);
+	device_sink_t input_writer;
+	ring_sink_init(&input_writer, "mouse", &input_ring);
+	uint64_t time_us = 1000000;
+	for (size_t i = 0; i < sizeof(mouse_input) / sizeof(mouse_input[0]); i++) {
+		struct input_event ev = {
+			.time = { .tv_sec = time_us / 1000000, .tv_usec = time_us % 1000000 },
+			.type = mouse_input[i].type,
+			.code = mouse_input[i].code,
+			.value = mouse_input[i].value,
+		};
+		if (input_writer.write(&input_writer, &ev, 1) != 1) {
+			fprintf(stderr, "Fake mouse ring is full\n");
+			return 1;
+		}
+		if (ev.type == EV_SYN) {
+			time_us += 1000;
+		}
+	}
+
+	// The thread reads the ring until it is empty, then ends
+	static struct input_event output_events[RING_SIZE];
+	event_ring_t output_ring;
+	event_ring_init(&output_ring, output_events, RING_SIZE);
+	device_source_t mouse_source;
+	device_sink_t v_g502;
+	ring_source_init(&mouse_source, "mouse", &input_ring);
+	ring_sink_init(&v_g502, "mouse", &output_ring);
+	mouse_thread_args_t mouse_args = {
+		.source = &mouse_source,
+		.sink = &v_g502,
+	};
+	pthread_t mouse_thread;
+	pthread_create(&mouse_thread, NULL, mouse_thread_io_func, &mouse_args);
+	pthread_join(mouse_thread, NULL);
+
+	struct input_event mouse_output[RING_SIZE];
+	device_source_t output_reader;
+	ring_source_init(&output_reader, "mouse", &output_ring);
+	ssize_t mouse_count = output_reader.read(&output_reader, mouse_output, RING_SIZE);
+
+	struct input_event keyboard_output[RING_SIZE];
+	size_t keyboard_count = 0;
+	uint32_t source;
+	while (keyboard_count < RING_SIZE && kb_queue_pop(&kb_event_queue, &keyboard_output[keyboard_count], &source)) {
+		keyboard_count++;
+	}
+
+	int failures = compare("mouse", mouse_output, mouse_count, expected_mouse, sizeof(expected_mouse) / sizeof(expected_mouse[0]));
+	failures += compare("keyboard", keyboard_output, keyboard_count, expected_keyboard, sizeof(expected_keyboard) / sizeof(expected_keyboard[0]));
+	return failures ? 1 : 0;
+}
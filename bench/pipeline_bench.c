@@ -0,0 +1,260 @@
+/*
+   End-to-end benchmark of the threaded mode's event processing, with pipes standing in for the grabbed and virtual devices.
+
+   A generator thread writes scenario traffic stamped with CLOCK_MONOTONIC into one pipe per fake input device, which the daemon's own
+   mouse_thread_io_func(), keyboard_process_i() and keyboard_process_o() read and write through fd sources and sinks (see event_io.h).
+   A drain thread empties both virtual device pipes, so the daemon's latency histograms measure generator write to virtual device write.
+   CPU per event counts the daemon's threads only, not the generator or the drains.
+   The keyboard queue peak is the deepest the keyboard event buffer got, which EVENT_BUFFER_SIZE is sized from.
+
+   Build with `./build.sh bench` and run `./bench/pipeline_bench [scenario] [seconds]`, every scenario runs if none is given.
+   Compiled-in defaults from config.h apply, the config file is not read.
+*/
+
+#define main g502d_main
+#include "../g502d.c"
+#undef main
+
+typedef struct {
+	const char* name;
+	const char* description;
+	uint64_t tick_ns; // Generator period, 0 floods the pipes as fast as they drain
+	void (*tick)(uint64_t i);
+} scenario_t;
+
+static int mouse_pipe[2];
+static int kb_pipe[2];
+static uint64_t generated_events;
+// Stats blocks of the threads running for the whole benchmark (the OUTPUT thread), each scenario's threads get the ones after
+static int base_thread_stats;
+
+static uint64_t thread_cpu_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Stamp and write a frame to a fake device, like evdev every event of a frame shares its timestamp
+static void emit(int fd, struct input_event* events, size_t count) {
+	uint64_t now = monotonic_now_ns();
+	for (size_t i = 0; i < count; i++) {
+		events[i].time.tv_sec = now / 1000000000ull;
+		events[i].time.tv_usec = now % 1000000000ull / 1000;
+	}
+	if (write(fd, events, count * sizeof(events[0])) != (ssize_t)(count * sizeof(events[0]))) {
+		fprintf(stderr, "Short write to fake device\n");
+		exit(1);
+	}
+	generated_events += count;
+}
+
+static void emit_motion(uint64_t i) {
+	struct input_event frame[3] = {
+		{ .type = EV_REL, .code = REL_X, .value = (i & 1) ? 3 : -2 },
+		{ .type = EV_REL, .code = REL_Y, .value = (i & 2) ? 1 : -1 },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	emit(mouse_pipe[1], frame, 3);
+}
+
+static void emit_key(int fd, uint32_t scan, uint16_t code, int32_t value) {
+	struct input_event frame[3] = {
+		{ .type = EV_MSC, .code = MSC_SCAN, .value = scan },
+		{ .type = EV_KEY, .code = code, .value = value },
+		{ .type = EV_SYN, .code = SYN_REPORT },
+	};
+	emit(fd, frame, 3);
+}
+
+// 8000 Hz motion, the fastest the G502 X family polls
+static void mouse_8k_tick(uint64_t i) {
+	emit_motion(i);
+}
+
+// 1000 Hz motion with bursts of 16 keystrokes, a press or release every 4 ms, five times a second
+static void typing_tick(uint64_t i) {
+	emit_motion(i);
+	uint64_t phase = i % 200;
+	if (phase < 128 && phase % 4 == 0) {
+		uint16_t key = KEY_A + (phase / 8) % 26;
+		emit_key(kb_pipe[1], 0x70004 + key - KEY_A, key, phase % 8 == 0);
+	}
+}
+
+// 1000 Hz motion with a side button held as a modifier for a keystroke ten times a second
+static void chords_tick(uint64_t i) {
+	emit_motion(i);
+	switch (i % 100) {
+	case 0: emit_key(mouse_pipe[1], 0x90004, BTN_SIDE, 1); break;
+	case 10: emit_key(kb_pipe[1], 0x70004, KEY_A, 1); break;
+	case 15: emit_key(kb_pipe[1], 0x70004, KEY_A, 0); break;
+	case 30: emit_key(mouse_pipe[1], 0x90004, BTN_SIDE, 0); break;
+	}
+}
+
+// Keystrokes with a side button chord every eighth, sent as fast as the keyboard event buffer drains, its worst case
+static void kb_flood_tick(uint64_t i) {
+	uint16_t key = KEY_A + (i / 2) % 26;
+	emit_key(kb_pipe[1], 0x70004 + key - KEY_A, key, !(i & 1));
+	if (i % 8 == 0) {
+		emit_key(mouse_pipe[1], 0x90004, BTN_SIDE, !(i & 8));
+	}
+}
+
+static const scenario_t scenarios[] = {
+	{ "mouse-8k", "8000 Hz motion", 125000, mouse_8k_tick },
+	{ "typing", "1000 Hz motion with typing bursts", 1000000, typing_tick },
+	{ "chords", "1000 Hz motion with side button chords", 1000000, chords_tick },
+	{ "flood", "motion as fast as the pipeline drains it", 0, mouse_8k_tick },
+	{ "kb-flood", "keystrokes and chords as fast as the pipeline drains them", 0, kb_flood_tick },
+};
+
+// Stands in for the compositor, reading and discarding whatever reaches a virtual device
+static void* drain(void* args_void) {
+	int fd = *(int*)args_void;
+	char buffer[65536];
+	while (read(fd, buffer, sizeof(buffer)) > 0);
+	return NULL;
+}
+
+// CPU time of the generator and drain threads, which is left out of the process's
+static uint64_t harness_cpu_ns(const clockid_t* drain_clocks) {
+	return thread_cpu_ns(CLOCK_THREAD_CPUTIME_ID) + thread_cpu_ns(drain_clocks[0]) + thread_cpu_ns(drain_clocks[1]);
+}
+
+static void run(const scenario_t* scenario, double seconds, device_sink_t* v_g502, const clockid_t* drain_clocks) {
+	if (pipe(mouse_pipe) < 0 || pipe(kb_pipe) < 0) {
+		fprintf(stderr, "Failed to create fake device pipes\n");
+		exit(1);
+	}
+	memset(latency_histograms, 0, sizeof(latency_histograms));
+	generated_events = 0;
+	uint64_t cpu_start = thread_cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - harness_cpu_ns(drain_clocks);
+
+	// The threads end once the pipes are closed
+	device_source_t mouse_source;
+	device_source_t kb_source;
+	fd_source_init(&mouse_source, "mouse", mouse_pipe[0]);
+	fd_source_init(&kb_source, "keyboard", kb_pipe[0]);
+	mouse_thread_args_t mouse_args = {
+		.source = &mouse_source,
+		.sink = v_g502,
+	};
+	keyboard_thread_args_t kb_args = {
+		.source = &kb_source,
+	};
+	pthread_t mouse_thread;
+	pthread_t kb_thread;
+	pthread_create(&mouse_thread, NULL, mouse_thread_io_func, &mouse_args);
+	pthread_create(&kb_thread, NULL, keyboard_process_i, &kb_args);
+
+	uint64_t start = monotonic_now_ns();
+	uint64_t end = start + (uint64_t)(seconds * 1e9);
+	for (uint64_t i = 0; ; i++) {
+		uint64_t due = start + i * scenario->tick_ns;
+		if (due >= end || (scenario->tick_ns == 0 && monotonic_now_ns() >= end)) {
+			break;
+		}
+		if (scenario->tick_ns) {
+			struct timespec ts = { .tv_sec = due / 1000000000ull, .tv_nsec = due % 1000000000ull };
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+		scenario->tick(i);
+	}
+
+	// Closing the fake devices ends the readers, then wait for the OUTPUT thread to catch up
+	close(mouse_pipe[1]);
+	close(kb_pipe[1]);
+	pthread_join(mouse_thread, NULL);
+	pthread_join(kb_thread, NULL);
+	while (!kb_queue_idle(&kb_event_queue)) {
+		usleep(100);
+	}
+	double elapsed = (monotonic_now_ns() - start) / 1e9;
+	uint64_t cpu_ns = thread_cpu_ns(CLOCK_PROCESS_CPUTIME_ID) - harness_cpu_ns(drain_clocks) - cpu_start;
+	close(mouse_pipe[0]);
+	close(kb_pipe[0]);
+
+	printf("%-9s %10" PRIu64 " events %10.0f ev/s  cpu %6.0f ns/event  (%s)\n",
+		scenario->name, generated_events, generated_events / elapsed, (double)cpu_ns / generated_events, scenario->description);
+	for (int i = 0; i < EVENT_NUM_SOURCES; i++) {
+		const latency_histogram_t* histogram = &latency_histograms[i];
+		if (latency_count(histogram) == 0) {
+			continue;
+		}
+		printf("  %-16s p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  (%" PRIu64 " samples)\n",
+			event_source_names[i],
+			latency_percentile(histogram, 50.0) / 1e3,
+			latency_percentile(histogram, 99.0) / 1e3,
+			latency_percentile(histogram, 99.9) / 1e3,
+			latency_count(histogram));
+	}
+	printf("  %-16s peak %" PRIu64 "/%d events\n", "keyboard queue",
+		stats_max_over_threads(offsetof(thread_stats_t, kb_queue_high_water)), EVENT_BUFFER_SIZE);
+
+	// The scenario's threads are joined, hand their stats blocks and RCU reader to the next scenario's
+	// Otherwise registrations would run out after a few scenarios and later threads would share a block, which stats.h forbids
+	memset(&all_thread_stats[base_thread_stats], 0, (MAX_STATS_THREADS - base_thread_stats) * sizeof(all_thread_stats[0]));
+	atomic_store(&num_thread_stats, base_thread_stats);
+	atomic_store(&rcu_num_readers, 0);
+}
+
+int main(int argc, char** argv) {
+	const char* only = argc > 1 ? argv[1] : NULL;
+	double seconds = argc > 2 ? atof(argv[2]) : 2.0;
+	size_t num_scenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+	size_t matched = 0;
+	for (size_t i = 0; i < num_scenarios; i++) {
+		matched += !only || strcmp(only, scenarios[i].name) == 0;
+	}
+	if (matched == 0 || seconds <= 0) {
+		fprintf(stderr, "Usage: %s [scenario] [seconds]\nScenarios:", argv[0]);
+		for (size_t i = 0; i < num_scenarios; i++) {
+			fprintf(stderr, " %s", scenarios[i].name);
+		}
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	config_set_defaults(&daemon_config);
+	atomic_store(&active_input_tables, build_input_tables(&daemon_config));
+	if (!atomic_load(&active_input_tables)) {
+		return 1;
+	}
+	kb_queue_init(&kb_event_queue, kb_event_buffer, EVENT_BUFFER_SIZE);
+
+	// Virtual devices, drained for the whole run
+	int v_g502_pipe[2];
+	int v_kb_pipe[2];
+	if (pipe(v_g502_pipe) < 0 || pipe(v_kb_pipe) < 0) {
+		fprintf(stderr, "Failed to create virtual device pipes\n");
+		return 1;
+	}
+	pthread_t drain_threads[2];
+	clockid_t drain_clocks[2];
+	pthread_create(&drain_threads[0], NULL, drain, &v_g502_pipe[0]);
+	pthread_create(&drain_threads[1], NULL, drain, &v_kb_pipe[0]);
+	pthread_getcpuclockid(drain_threads[0], &drain_clocks[0]);
+	pthread_getcpuclockid(drain_threads[1], &drain_clocks[1]);
+	device_sink_t v_g502_sink;
+	device_sink_t v_kb_sink;
+	fd_sink_init(&v_g502_sink, "mouse", v_g502_pipe[1]);
+	fd_sink_init(&v_kb_sink, "keyboard", v_kb_pipe[1]);
+
+	keyboard_output_thread_args_t kb_output_args = {
+		.sink = &v_kb_sink,
+	};
+	pthread_t kb_output_thread;
+	pthread_create(&kb_output_thread, NULL, keyboard_process_o, &kb_output_args);
+	while (atomic_load(&num_thread_stats) == 0) {
+		usleep(100);
+	}
+	base_thread_stats = atomic_load(&num_thread_stats);
+
+	for (size_t i = 0; i < num_scenarios; i++) {
+		if (!only || strcmp(only, scenarios[i].name) == 0) {
+			run(&scenarios[i], seconds, &v_g502_sink, drain_clocks);
+		}
+	}
+	return 0;
+}
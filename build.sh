@@ -1,2 +1,11 @@
 #!/bin/bash
-gcc -o g502d g502d.c -lsystemd -lm -I/usr/include/libevdev-1.0
+if [ "$1" == "bench" ]; then
+	# Microbenchmarks and self-checks, see bench/
+	gcc -O2 -o bench/kb_queue_bench bench/kb_queue_bench.c -lpthread
+	gcc -O2 -o bench/pipeline_bench bench/pipeline_bench.c -lpthread -lsystemd -levdev -lm -I/usr/include/libevdev-1.0
+	gcc -O2 -o bench/dpi_drift_test bench/dpi_drift_test.c -lpthread -lsystemd -levdev -lm -I/usr/include/libevdev-1.0
+	gcc -O2 -o bench/mouse_ring_test bench/mouse_ring_test.c -lpthread -lsystemd -levdev -lm -I/usr/include/libevdev-1.0
+	exit
+fi
+
+gcc -o g502d g502d.c -lsystemd -levdev -lm -I/usr/include/libevdev-1.0
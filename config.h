@@ -1,6 +1,7 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+// Compiled-in defaults, a config file ($XDG_CONFIG_HOME/g502d/g502d.conf or --config) can override the identifiers and remaps
 // G502 identifiers
 #define G502_USB_VENDOR_ID   0x046d
 #define G502_USB_VENDOR_ID_S "046d"
@@ -17,7 +18,45 @@
 #define KB_MODEL_ID        0x0862
 #define KB_MODEL_ID_S      "0862"
 
+// Mouse buttons remapped to keys, { button, key }
+#define DEFAULT_BUTTON_REMAPS { { BTN_SIDE, KEY_LEFTSHIFT }, { BTN_EXTRA, KEY_LEFTCTRL } }
+// Magic scan codes for the remapped side buttons, { mouse scan code, keyboard scan code }
+#define DEFAULT_SCAN_REMAPS { { 0x90004, 0x70004 }, { 0x90005, 0x70005 } }
+
 // DPI scaling factor (for converting G502 DPI to OS cursor speed)
-#define DPI_SCALE 0.5
+// Fixed-point, the factor is DPI_SCALE_NUM / 2^DPI_SCALE_SHIFT, e.g. 0.5 = 32768 / 2^16 and 0.37 ~= 24248 / 2^16
+#define DPI_SCALE_NUM   32768
+#define DPI_SCALE_SHIFT 16
+
+// Pointer acceleration, applied on top of DPI_SCALE (see accel.h), can be overridden with --accel=PROFILE
+// Speeds are in G502 counts per millisecond, before DPI scaling
+#define ACCEL_PROFILE  ACCEL_PROFILE_FLAT
+#define ACCEL_OFFSET   2.0  // Linear/power: speed below which the gain stays 1
+#define ACCEL_FACTOR   0.05 // Linear/power: gain increase per count/ms above the offset (raised to ACCEL_EXPONENT for power)
+#define ACCEL_EXPONENT 1.5  // Power only
+#define ACCEL_MAX_GAIN 3.0  // Upper bound on the gain, 0 for none
+// Piecewise: { speed, gain } points in increasing speed, interpolated linearly and held constant past either end
+#define ACCEL_POINTS { { 2.0, 1.0 }, { 8.0, 1.5 }, { 24.0, 2.5 } }
+
+// Motion coalescing, merge G502 movement into at most this many frames per second (e.g. 250 or 500) to cut compositor wakeups
+// Button frames are never delayed, 0 forwards every report as it arrives, can be overridden with --coalesce=HZ
+#define COALESCE_RATE_HZ 0
+
+// What the threaded mode does when the keyboard OUTPUT thread falls behind, can be overridden with --overflow=POLICY
+// KB_OVERFLOW_BLOCK, KB_OVERFLOW_DROP_OLDEST (drop the oldest whole frames) or KB_OVERFLOW_COALESCE (drop key repeats)
+// Key releases are never dropped, producers wait for space instead
+#define KB_OVERFLOW_POLICY KB_OVERFLOW_BLOCK
+
+// Real-time mode (--realtime)
+// SCHED_FIFO priority (1-99) of each input thread, needs CAP_SYS_NICE or a high enough RLIMIT_RTPRIO
+// The --reactor and --io-uring modes run everything at the mouse thread's priority
+#define RT_PRIORITY_MOUSE     50
+#define RT_PRIORITY_KB_INPUT  50
+#define RT_PRIORITY_KB_OUTPUT 50
+// CPUs to pin the input threads to, -1 leaves a thread unpinned
+// The --reactor and --io-uring modes run everything on the mouse thread's CPU
+#define RT_CPU_MOUSE     -1
+#define RT_CPU_KB_INPUT  -1
+#define RT_CPU_KB_OUTPUT -1
 
 #endif // CONFIG_H
@@ -0,0 +1,454 @@
+#ifndef CONFIG_FILE_H
+#define CONFIG_FILE_H
+
+/*
+   Runtime configuration file, read once at startup so identifiers and remaps can change without a rebuild.
+   Anything the file leaves out keeps its compiled-in default from config.h.
+
+   INI format, '#' or ';' start a comment:
+
+       [mouse]
+       vendor_id = 046d
+       model_id = c332
+
+       [keyboard]
+       vendor_id = 17f6
+       model_id = 0862
+
+       # Every [mouse] or [keyboard] section adds another device, all merged into the same virtual devices
+       # Devices without USB identifiers, like a laptop's built-in keyboard, are matched on udev's ID_PATH instead
+       # Identical devices need it too, two sections of a kind may not match the same devices
+       [keyboard]
+       id_path = platform-i8042-serio-0
+
+       [buttons]
+       # Mouse button = key (names as in linux/input-event-codes.h, or numbers)
+       # Keyboard keys go to the virtual keyboard, mouse buttons stay on the virtual G502
+       BTN_SIDE = KEY_LEFTSHIFT
+       BTN_EXTRA = KEY_LEFTCTRL
+
+       [scancodes]
+       # MSC_SCAN value from the mouse = value sent to the virtual keyboard
+       0x90004 = 0x70004
+       0x90005 = 0x70005
+
+       [pointer]
+       dpi_scale = 0.5
+       accel = piecewise          # flat, linear, power or piecewise, see accel.h
+       accel_offset = 2.0
+       accel_factor = 0.05
+       accel_exponent = 1.5
+       accel_max_gain = 3.0
+       accel_points = 2:1.0, 8:1.5, 24:2.5   # speed:gain pairs for piecewise
+
+   A [mouse], [keyboard], [buttons] or [scancodes] section replaces the defaults of that kind rather than adding to them,
+   so an empty [buttons] or [scancodes] section turns that remapping off.
+   Everything but the device identifiers can be reloaded while running (SIGHUP or the control socket's reload command).
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <libevdev/libevdev.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "accel.h"
+#include "config.h"
+#include "remap.h"
+#include "stats.h"
+
+#define CONFIG_FILE_NAME "g502d.conf"
+#define ACCEL_MAX_POINTS 16
+#define MAX_DEVICES_PER_KIND 4
+
+typedef struct {
+	char vendor_id[8]; // Hex as in udev's ID_USB_VENDOR_ID/ID_MODEL_ID, e.g. "046d"
+	char model_id[8];
+	uint16_t vendor;   // Parsed, for the virtual device
+	uint16_t model;
+	char id_path[64];  // udev's ID_PATH, matched instead of the USB identifiers if set
+} usb_device_ids_t;
+
+typedef struct {
+	// Grabbed devices of each kind, the first of each kind lends its identifiers to the virtual device
+	usb_device_ids_t devices[NUM_INPUT_DEVICES][MAX_DEVICES_PER_KIND];
+	size_t num_devices[NUM_INPUT_DEVICES];
+	remap_tables_t remap;
+	// Pointer settings, the curve's points are kept here so the struct can be copied
+	double dpi_scale;
+	accel_curve_t accel;
+	accel_point_t accel_points[ACCEL_MAX_POINTS];
+} daemon_config_t;
+
+// The acceleration curve with its points resolved against this copy of the config
+static inline accel_curve_t config_accel_curve(const daemon_config_t* config) {
+	accel_curve_t curve = config->accel;
+	curve.points = config->accel_points;
+	return curve;
+}
+
+static inline int config_set_usb_id(char* id_str, size_t size, uint16_t* id, const char* value) {
+	size_t len = strlen(value);
+	if (len != 4 || strspn(value, "0123456789abcdefABCDEF") != len) {
+		return -1;
+	}
+	snprintf(id_str, size, "%s", value);
+	for (char* c = id_str; *c; c++) {
+		*c = tolower((unsigned char)*c); // udev reports lowercase
+	}
+	*id = (uint16_t)strtoul(value, NULL, 16);
+	return 0;
+}
+
+// Parse a key or button name (KEY_A, BTN_SIDE) or number
+static inline int config_parse_key_code(const char* value) {
+	int code = libevdev_event_code_from_name(EV_KEY, value);
+	if (code < 0) {
+		char* end;
+		errno = 0;
+		long number = strtol(value, &end, 0);
+		if (errno != 0 || end == value || *end != '\0') {
+			return -1;
+		}
+		code = (int)number;
+	}
+	return code >= 0 && code < KEY_CNT ? code : -1;
+}
+
+static inline int config_parse_double(const char* value, double* out) {
+	char* end;
+	errno = 0;
+	double number = strtod(value, &end);
+	if (errno != 0 || end == value || *end != '\0') {
+		return -1;
+	}
+	*out = number;
+	return 0;
+}
+
+// Parse "speed:gain, speed:gain, ..." in increasing speed
+static inline int config_parse_accel_points(const char* value, accel_point_t* points, size_t* num_points) {
+	size_t count = 0;
+	const char* cursor = value;
+	while (*cursor) {
+		char* end;
+		if (count == ACCEL_MAX_POINTS) {
+			return -1;
+		}
+		points[count].speed = strtod(cursor, &end);
+		if (end == cursor || *end != ':') {
+			return -1;
+		}
+		cursor = end + 1;
+		points[count].gain = strtod(cursor, &end);
+		if (end == cursor || (count > 0 && points[count].speed < points[count - 1].speed)) {
+			return -1;
+		}
+		count++;
+		cursor = end;
+		while (isspace((unsigned char)*cursor) || *cursor == ',') {
+			cursor++;
+		}
+	}
+	*num_points = count;
+	return 0;
+}
+
+static inline int config_parse_u32(const char* value, uint32_t* out) {
+	char* end;
+	errno = 0;
+	unsigned long number = strtoul(value, &end, 0);
+	if (errno != 0 || end == value || *end != '\0' || number > UINT32_MAX) {
+		return -1;
+	}
+	*out = (uint32_t)number;
+	return 0;
+}
+
+static inline char* config_trim(char* s) {
+	while (isspace((unsigned char)*s)) {
+		s++;
+	}
+	char* end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1])) {
+		*--end = '\0';
+	}
+	return s;
+}
+
+// Compiled-in defaults from config.h
+static inline void config_set_defaults(daemon_config_t* config) {
+	usb_device_ids_t* mouse = &config->devices[INPUT_DEVICE_MOUSE][0];
+	usb_device_ids_t* keyboard = &config->devices[INPUT_DEVICE_KEYBOARD][0];
+	config_set_usb_id(mouse->vendor_id, sizeof(mouse->vendor_id), &mouse->vendor, G502_USB_VENDOR_ID_S);
+	config_set_usb_id(mouse->model_id, sizeof(mouse->model_id), &mouse->model, G502_MODEL_ID_S);
+	config_set_usb_id(keyboard->vendor_id, sizeof(keyboard->vendor_id), &keyboard->vendor, KB_USB_VENDOR_ID_S);
+	config_set_usb_id(keyboard->model_id, sizeof(keyboard->model_id), &keyboard->model, KB_MODEL_ID_S);
+	config->num_devices[INPUT_DEVICE_MOUSE] = 1;
+	config->num_devices[INPUT_DEVICE_KEYBOARD] = 1;
+
+	remap_tables_init(&config->remap);
+	static const uint16_t button_remaps[][2] = DEFAULT_BUTTON_REMAPS;
+	for (size_t i = 0; i < sizeof(button_remaps) / sizeof(button_remaps[0]); i++) {
+		remap_tables_set_key(&config->remap, button_remaps[i][0], button_remaps[i][1]);
+	}
+	static const uint32_t scan_remaps[][2] = DEFAULT_SCAN_REMAPS;
+	scan_remap_build(&config->remap.scans, scan_remaps, sizeof(scan_remaps) / sizeof(scan_remaps[0]));
+
+	config->dpi_scale = (double)DPI_SCALE_NUM / (1 << DPI_SCALE_SHIFT);
+	static const accel_point_t accel_points[] = ACCEL_POINTS;
+	config->accel = (accel_curve_t){
+		.profile = ACCEL_PROFILE,
+		.offset = ACCEL_OFFSET,
+		.factor = ACCEL_FACTOR,
+		.exponent = ACCEL_EXPONENT,
+		.max_gain = ACCEL_MAX_GAIN,
+		.num_points = sizeof(accel_points) / sizeof(accel_points[0]),
+	};
+	memcpy(config->accel_points, accel_points, sizeof(accel_points));
+}
+
+// Whether two configs grab the same devices, which can only change on restart
+static inline bool config_devices_equal(const daemon_config_t* a, const daemon_config_t* b) {
+	for (int kind = 0; kind < NUM_INPUT_DEVICES; kind++) {
+		if (a->num_devices[kind] != b->num_devices[kind]) {
+			return false;
+		}
+		for (size_t i = 0; i < a->num_devices[kind]; i++) {
+			const usb_device_ids_t* x = &a->devices[kind][i];
+			const usb_device_ids_t* y = &b->devices[kind][i];
+			if (strcmp(x->vendor_id, y->vendor_id) != 0 || strcmp(x->model_id, y->model_id) != 0 || strcmp(x->id_path, y->id_path) != 0) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// $XDG_CONFIG_HOME/g502d/g502d.conf, falling back to ~/.config, or NULL if neither is set
+static inline char* config_default_path(void) {
+	char path[PATH_MAX];
+	const char* config_home = getenv("XDG_CONFIG_HOME");
+	const char* home = getenv("HOME");
+	if (config_home && *config_home) {
+		snprintf(path, sizeof(path), "%s/g502d/%s", config_home, CONFIG_FILE_NAME);
+	} else if (home && *home) {
+		snprintf(path, sizeof(path), "%s/.config/g502d/%s", home, CONFIG_FILE_NAME);
+	} else {
+		return NULL;
+	}
+	return strdup(path);
+}
+
+// Whether two device entries match the same event nodes, entries with id_path only match on it
+static inline bool config_same_devices(const usb_device_ids_t* a, const usb_device_ids_t* b) {
+	if (a->id_path[0] || b->id_path[0]) {
+		return strcmp(a->id_path, b->id_path) == 0;
+	}
+	return strcmp(a->vendor_id, b->vendor_id) == 0 && strcmp(a->model_id, b->model_id) == 0;
+}
+
+// Load the config file on top of the defaults
+// A missing file is only an error if `required` (given explicitly with --config)
+// Returns 0 on success or -1 after printing what is wrong, leaving `config` untouched
+static inline int config_load(daemon_config_t* config, const char* path, bool required) {
+	FILE* file = fopen(path, "r");
+	if (!file) {
+		int err = errno;
+		if (err == ENOENT && !required) {
+			return 0;
+		}
+		fprintf(stderr, "Failed to open config file %s: %s\n", path, strerror(err));
+		return -1;
+	}
+
+	daemon_config_t parsed = *config;
+	uint32_t scan_remaps[SCAN_REMAP_MAX][2];
+	size_t num_scan_remaps = 0;
+	bool devices_seen[NUM_INPUT_DEVICES] = { false };
+	bool buttons_seen = false;
+	bool scancodes_seen = false;
+	char section[32] = "";
+	char line[256];
+	int line_number = 0;
+	int ret = 0;
+	while (ret == 0 && fgets(line, sizeof(line), file)) {
+		line_number++;
+		line[strcspn(line, "#;\n")] = '\0';
+		char* text = config_trim(line);
+		if (*text == '\0') {
+			continue;
+		}
+
+		if (*text == '[') {
+			char* close = strchr(text, ']');
+			if (!close || close[1] != '\0') {
+				fprintf(stderr, "%s:%d: Malformed section header\n", path, line_number);
+				ret = -1;
+				break;
+			}
+			*close = '\0';
+			snprintf(section, sizeof(section), "%s", config_trim(text + 1));
+			if (strcmp(section, "mouse") == 0 || strcmp(section, "keyboard") == 0) {
+				// Each device section adds a device, the first one of a kind replaces the defaults
+				input_device_id_t kind = strcmp(section, "mouse") == 0 ? INPUT_DEVICE_MOUSE : INPUT_DEVICE_KEYBOARD;
+				if (!devices_seen[kind]) {
+					parsed.num_devices[kind] = 0;
+					devices_seen[kind] = true;
+				}
+				if (parsed.num_devices[kind] == MAX_DEVICES_PER_KIND) {
+					fprintf(stderr, "%s:%d: Too many [%s] sections (at most %d)\n", path, line_number, section, MAX_DEVICES_PER_KIND);
+					ret = -1;
+					break;
+				}
+				// Identifiers default to the compiled-in ones until set
+				parsed.devices[kind][parsed.num_devices[kind]] = config->devices[kind][0];
+				parsed.num_devices[kind]++;
+			}
+			// Remap sections replace the defaults as soon as they appear, so an empty one turns that remapping off
+			if (strcmp(section, "buttons") == 0 && !buttons_seen) {
+				// Keep the scan code table, only the button remaps are replaced
+				scan_remap_table_t scans = parsed.remap.scans;
+				remap_tables_init(&parsed.remap);
+				parsed.remap.scans = scans;
+				buttons_seen = true;
+			}
+			if (strcmp(section, "scancodes") == 0) {
+				// Built from scan_remaps once the whole file is read
+				scancodes_seen = true;
+			}
+			if (strcmp(section, "mouse") != 0 && strcmp(section, "keyboard") != 0 && strcmp(section, "buttons") != 0 &&
+			    strcmp(section, "scancodes") != 0 && strcmp(section, "pointer") != 0) {
+				fprintf(stderr, "%s:%d: Unknown section [%s]\n", path, line_number, section);
+				ret = -1;
+			}
+			continue;
+		}
+
+		char* equals = strchr(text, '=');
+		if (!equals || section[0] == '\0') {
+			fprintf(stderr, "%s:%d: Expected key = value inside a section\n", path, line_number);
+			ret = -1;
+			break;
+		}
+		*equals = '\0';
+		char* key = config_trim(text);
+		char* value = config_trim(equals + 1);
+
+		if (strcmp(section, "mouse") == 0 || strcmp(section, "keyboard") == 0) {
+			input_device_id_t kind = strcmp(section, "mouse") == 0 ? INPUT_DEVICE_MOUSE : INPUT_DEVICE_KEYBOARD;
+			usb_device_ids_t* ids = &parsed.devices[kind][parsed.num_devices[kind] - 1];
+			int result = -1;
+			if (strcmp(key, "vendor_id") == 0) {
+				result = config_set_usb_id(ids->vendor_id, sizeof(ids->vendor_id), &ids->vendor, value);
+			} else if (strcmp(key, "model_id") == 0) {
+				result = config_set_usb_id(ids->model_id, sizeof(ids->model_id), &ids->model, value);
+			} else if (strcmp(key, "id_path") == 0) {
+				if (*value == '\0' || strlen(value) >= sizeof(ids->id_path)) {
+					fprintf(stderr, "%s:%d: Invalid id_path \"%s\"\n", path, line_number, value);
+					ret = -1;
+					break;
+				}
+				snprintf(ids->id_path, sizeof(ids->id_path), "%s", value);
+				result = 0;
+			} else {
+				fprintf(stderr, "%s:%d: Unknown key %s in [%s]\n", path, line_number, key, section);
+				ret = -1;
+				break;
+			}
+			if (result < 0) {
+				fprintf(stderr, "%s:%d: Expected 4 hex digits for %s, got \"%s\"\n", path, line_number, key, value);
+				ret = -1;
+			}
+		} else if (strcmp(section, "buttons") == 0) {
+			int from = config_parse_key_code(key);
+			int to = config_parse_key_code(value);
+			if (from < 0 || to < 0) {
+				fprintf(stderr, "%s:%d: Unknown key code \"%s\"\n", path, line_number, from < 0 ? key : value);
+				ret = -1;
+				break;
+			}
+			remap_tables_set_key(&parsed.remap, from, to);
+		} else if (strcmp(section, "pointer") == 0) {
+			int result = -1;
+			if (strcmp(key, "dpi_scale") == 0) {
+				result = config_parse_double(value, &parsed.dpi_scale);
+				if (result == 0 && !(parsed.dpi_scale > 0)) {
+					result = -1;
+				}
+			} else if (strcmp(key, "accel") == 0) {
+				int profile = accel_profile_from_name(value);
+				if (profile >= 0) {
+					parsed.accel.profile = profile;
+					result = 0;
+				}
+			} else if (strcmp(key, "accel_offset") == 0) {
+				result = config_parse_double(value, &parsed.accel.offset);
+			} else if (strcmp(key, "accel_factor") == 0) {
+				result = config_parse_double(value, &parsed.accel.factor);
+			} else if (strcmp(key, "accel_exponent") == 0) {
+				result = config_parse_double(value, &parsed.accel.exponent);
+			} else if (strcmp(key, "accel_max_gain") == 0) {
+				result = config_parse_double(value, &parsed.accel.max_gain);
+			} else if (strcmp(key, "accel_points") == 0) {
+				result = config_parse_accel_points(value, parsed.accel_points, &parsed.accel.num_points);
+			} else {
+				fprintf(stderr, "%s:%d: Unknown key %s in [%s]\n", path, line_number, key, section);
+				ret = -1;
+				break;
+			}
+			if (result < 0) {
+				fprintf(stderr, "%s:%d: Invalid value for %s: \"%s\"\n", path, line_number, key, value);
+				ret = -1;
+			}
+		} else {
+			uint32_t from, to;
+			if (config_parse_u32(key, &from) < 0 || config_parse_u32(value, &to) < 0) {
+				fprintf(stderr, "%s:%d: Expected numeric scan codes\n", path, line_number);
+				ret = -1;
+				break;
+			}
+			size_t i;
+			for (i = 0; i < num_scan_remaps && scan_remaps[i][0] != from; i++);
+			if (i == SCAN_REMAP_MAX) {
+				fprintf(stderr, "%s:%d: Too many scan code remaps (at most %d)\n", path, line_number, SCAN_REMAP_MAX);
+				ret = -1;
+				break;
+			}
+			// A repeated scan code overrides the earlier line
+			scan_remaps[i][0] = from;
+			scan_remaps[i][1] = to;
+			if (i == num_scan_remaps) {
+				num_scan_remaps++;
+			}
+		}
+	}
+	fclose(file);
+
+	if (ret == 0 && scancodes_seen && scan_remap_build(&parsed.remap.scans, scan_remaps, num_scan_remaps) < 0) {
+		ret = -1;
+	}
+	// Identical devices can't be told apart by their identifiers: most have several event nodes (the G502 a mouse and a keyboard one),
+	// so a second entry could grab another node of the first device rather than the second device
+	for (int kind = 0; ret == 0 && kind < NUM_INPUT_DEVICES; kind++) {
+		for (size_t i = 0; ret == 0 && i < parsed.num_devices[kind]; i++) {
+			for (size_t j = i + 1; ret == 0 && j < parsed.num_devices[kind]; j++) {
+				if (config_same_devices(&parsed.devices[kind][i], &parsed.devices[kind][j])) {
+					fprintf(stderr, "%s: [%s] sections %zu and %zu match the same devices, give each a different id_path\n",
+						path, kind == INPUT_DEVICE_MOUSE ? "mouse" : "keyboard", i + 1, j + 1);
+					ret = -1;
+				}
+			}
+		}
+	}
+	if (ret == 0) {
+		*config = parsed;
+		fprintf(stderr, "Loaded config file %s\n", path);
+	}
+	return ret;
+}
+
+#endif // CONFIG_FILE_H
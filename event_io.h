@@ -0,0 +1,181 @@
+#ifndef EVENT_IO_H
+#define EVENT_IO_H
+
+/*
+   Where the event pipeline reads input_events from (sources) and writes them to (sinks).
+
+   The input threads and the virtual device frames only go through these, so the same processing runs against the grabbed
+   evdev devices and uinput in the daemon, against pipes or files in bench/, and against in-memory rings with no devices at all.
+   Any file descriptor works as either end (evdev, uinput, pipes, raw input_event files), the evdev source with hotplug
+   reconnection is built on top of it in g502d.c.
+   A source reaching the end of its stream (end of file, an empty ring, a finished recording) ends the thread reading it.
+*/
+
+#include <errno.h>
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "record.h"
+
+typedef struct device_source device_source_t;
+struct device_source {
+	const char* name; // For log messages
+	int fd;           // Pollable descriptor, -1 for sources in memory which are always ready
+	void* context;    // Implementation state
+	// Read up to `max` whole events, returns how many were read, 0 at the end of the stream, or -1 with errno set
+	ssize_t (*read)(device_source_t* source, struct input_event* events, size_t max);
+	// Recover after a failed read, returns 0 once reading can resume or -1 if it never will, NULL if the source can't recover
+	int (*reopen)(device_source_t* source);
+	// Optional, called once the stream has ended
+	void (*close)(device_source_t* source);
+};
+
+typedef struct device_sink device_sink_t;
+struct device_sink {
+	const char* name;
+	int fd; // -1 for sinks in memory
+	void* context;
+	// Write a batch of events, returns how many were written or -1 with errno set
+	ssize_t (*write)(device_sink_t* sink, const struct input_event* events, size_t count);
+};
+
+// File descriptors
+
+// evdev only ever returns whole events, pipes may split one across reads so the rest of it is read before returning
+static inline ssize_t fd_source_read(device_source_t* source, struct input_event* events, size_t max) {
+	ssize_t n = read(source->fd, events, max * sizeof(events[0]));
+	while (n > 0 && n % sizeof(events[0]) != 0) {
+		ssize_t rest = read(source->fd, (char*)events + n, sizeof(events[0]) - n % sizeof(events[0]));
+		if (rest <= 0) {
+			// Truncated last event
+			errno = rest < 0 ? errno : EIO;
+			return -1;
+		}
+		n += rest;
+	}
+	return n < 0 ? -1 : n / (ssize_t)sizeof(events[0]);
+}
+
+static inline void fd_source_init(device_source_t* source, const char* name, int fd) {
+	*source = (device_source_t){ .name = name, .fd = fd, .read = fd_source_read };
+}
+
+static inline ssize_t fd_sink_write(device_sink_t* sink, const struct input_event* events, size_t count) {
+	ssize_t written = write(sink->fd, events, count * sizeof(events[0]));
+	return written < 0 ? -1 : written / (ssize_t)sizeof(events[0]);
+}
+
+// uinput devices, pipes and raw input_event files
+static inline void fd_sink_init(device_sink_t* sink, const char* name, int fd) {
+	*sink = (device_sink_t){ .name = name, .fd = fd, .write = fd_sink_write };
+}
+
+// In-memory ring, usable as a source and a sink by one thread at a time (or handed over with pthread_join)
+typedef struct {
+	struct input_event* events;
+	size_t mask; // Capacity - 1, the capacity is a power of two
+	size_t head; // Total events read
+	size_t tail; // Total events written
+} event_ring_t;
+
+// `capacity` must be a power of two
+static inline void event_ring_init(event_ring_t* ring, struct input_event* events, size_t capacity) {
+	ring->events = events;
+	ring->mask = capacity - 1;
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+static inline size_t event_ring_count(const event_ring_t* ring) {
+	return ring->tail - ring->head;
+}
+
+static inline ssize_t ring_source_read(device_source_t* source, struct input_event* events, size_t max) {
+	event_ring_t* ring = source->context;
+	size_t count = 0;
+	while (count < max && ring->head != ring->tail) {
+		events[count++] = ring->events[ring->head++ & ring->mask];
+	}
+	return count;
+}
+
+// Writes stop short once the ring is full, like a uinput device that can't keep up
+static inline ssize_t ring_sink_write(device_sink_t* sink, const struct input_event* events, size_t count) {
+	event_ring_t* ring = sink->context;
+	size_t written = 0;
+	while (written < count && event_ring_count(ring) <= ring->mask) {
+		ring->events[ring->tail++ & ring->mask] = events[written++];
+	}
+	if (written == 0 && count) {
+		errno = ENOSPC;
+		return -1;
+	}
+	return written;
+}
+
+static inline void ring_source_init(device_source_t* source, const char* name, event_ring_t* ring) {
+	*source = (device_source_t){ .name = name, .fd = -1, .context = ring, .read = ring_source_read };
+}
+
+static inline void ring_sink_init(device_sink_t* sink, const char* name, event_ring_t* ring) {
+	*sink = (device_sink_t){ .name = name, .fd = -1, .context = ring, .write = ring_sink_write };
+}
+
+// Recordings (see record.h), every recorded device's events with their rebuilt timestamps
+// Each read returns events of one device, like read() on it would, ending at a SYN_REPORT or a change of device
+typedef struct {
+	event_replayer_t replayer;
+	uint8_t device; // Which device the last read came from, input_device_id_t
+	uint8_t index;
+	struct input_event next; // Read ahead of a change of device, valid while `has_next`
+	uint8_t next_device;
+	uint8_t next_index;
+	bool has_next;
+} replay_source_t;
+
+static inline ssize_t replay_source_read(device_source_t* source, struct input_event* events, size_t max) {
+	replay_source_t* replay = source->context;
+	size_t count = 0;
+	while (count < max) {
+		if (!replay->has_next && !replayer_next(&replay->replayer, &replay->next, &replay->next_device, &replay->next_index)) {
+			break;
+		}
+		replay->has_next = true;
+		if (count && (replay->next_device != replay->device || replay->next_index != replay->index)) {
+			break;
+		}
+		replay->device = replay->next_device;
+		replay->index = replay->next_index;
+		replay->has_next = false;
+		events[count++] = replay->next;
+		if (replay->next.type == EV_SYN && replay->next.code == SYN_REPORT) {
+			break;
+		}
+	}
+	return count;
+}
+
+static inline void replay_source_close(device_source_t* source) {
+	replayer_close(&((replay_source_t*)source->context)->replayer);
+}
+
+// Returns 0 on success
+static inline int replay_source_open(device_source_t* source, replay_source_t* replay, const char* name, const char* path, uint64_t start_us) {
+	*replay = (replay_source_t){ 0 };
+	if (replayer_open(&replay->replayer, path, start_us) < 0) {
+		return -1;
+	}
+	*source = (device_source_t){
+		.name = name,
+		.fd = -1,
+		.context = replay,
+		.read = replay_source_read,
+		.close = replay_source_close,
+	};
+	return 0;
+}
+
+#endif // EVENT_IO_H
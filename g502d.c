@@ -10,31 +10,54 @@
       Mouse event device --*               *--> Virtual mouse device
 */
 
+#define _GNU_SOURCE // For CPU affinity
+
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <libevdev/libevdev-uinput.h>
 #include <libevdev/libevdev.h>
 #include <linux/input-event-codes.h>
 #include <linux/input.h>
 #include <linux/uinput.h>
-#include <math.h>
+#include <poll.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <systemd/sd-device.h>
+#include <systemd/sd-event.h>
 #include <unistd.h>
 
+#include "accel.h"
 #include "config.h"
+#include "config_file.h"
+#include "event_io.h"
+#include "kb_queue.h"
+#include "latency.h"
+#include "log.h"
+#include "probes.h"
+#include "rcu.h"
+#include "record.h"
+#include "remap.h"
+#include "stats.h"
+#include "uring.h"
 
-// Magic scan codes for mouse side buttons
-#define SCAN_BTN_SIDE  0x90004
-#define SCAN_BTN_EXTRA 0x90005
-#define SCAN_KEY_SHIFT 0x70004
-#define SCAN_KEY_CTRL  0x70005
+// Device identifiers and remap tables, compiled-in defaults overridden by the config file
+daemon_config_t daemon_config;
 
 // Helper function to get errno string
 static const char* get_errno_name(int err) {
@@ -46,6 +69,7 @@ static const char* get_errno_name(int err) {
 		case EAGAIN: return "EAGAIN (Would block)";
 		case ENOENT: return "ENOENT (No such file)";
 		case EACCES: return "EACCES (Permission denied)";
+		case ENOSPC: return "ENOSPC (No space left on device)";
 		default: return "UNKNOWN";
 	}
 }
@@ -55,23 +79,36 @@ static int is_fd_valid(int fd) {
 	return fcntl(fd, F_GETFD) >= 0;
 }
 
-// Helper function to find event device by vendor and model IDs
-static char* find_event_device(const char* vendor_id, const char* model_id, const char* device_name) {
+// Helper function to enumerate the event devices matching a device's identifiers
+static sd_device_enumerator* enumerate_event_devices(const usb_device_ids_t* ids, const char* device_name) {
 	struct sd_device_enumerator *enumerator = NULL;
 	int r = sd_device_enumerator_new(&enumerator);
 	if (r < 0) {
-		fprintf(stderr, "Failed to create device enumerator for %s\n", device_name);
+		log_device(LOG_ERR, device_name, -1, 0, "Failed to create device enumerator for %s", device_name);
 		return NULL;
 	}
 
 	sd_device_enumerator_add_match_subsystem(enumerator, "input", 1);
 	sd_device_enumerator_add_match_sysname(enumerator, "event*");
-	sd_device_enumerator_add_match_property(enumerator, "ID_USB_VENDOR_ID", vendor_id);
-	sd_device_enumerator_add_match_property(enumerator, "ID_MODEL_ID", model_id);
+	if (ids->id_path[0]) {
+		sd_device_enumerator_add_match_property(enumerator, "ID_PATH", ids->id_path);
+	} else {
+		sd_device_enumerator_add_match_property(enumerator, "ID_USB_VENDOR_ID", ids->vendor_id);
+		sd_device_enumerator_add_match_property(enumerator, "ID_MODEL_ID", ids->model_id);
+	}
+	return enumerator;
+}
+
+// Helper function to find event device by its identifiers
+static char* find_event_device(const usb_device_ids_t* ids, const char* device_name) {
+	sd_device_enumerator* enumerator = enumerate_event_devices(ids, device_name);
+	if (!enumerator) {
+		return NULL;
+	}
 
 	sd_device *device = sd_device_enumerator_get_device_first(enumerator);
 	if (!device) {
-		fprintf(stderr, "%s device not found\n", device_name);
+		log_device(LOG_ERR, device_name, -1, 0, "%s device not found", device_name);
 		sd_device_enumerator_unref(enumerator);
 		return NULL;
 	}
@@ -81,7 +118,7 @@ static char* find_event_device(const char* vendor_id, const char* model_id, cons
 	char* result = strdup(device_path);
 	sd_device_enumerator_unref(enumerator);
 	
-	fprintf(stderr, "%s device found: %s\n", device_name, result);
+	log_device(LOG_INFO, device_name, -1, 0, "%s device found: %s", device_name, result);
 	return result;
 }
 
@@ -89,29 +126,50 @@ static char* find_event_device(const char* vendor_id, const char* model_id, cons
 static int open_and_grab_device(const char* device_path, const char* device_name) {
 	int fd = open(device_path, O_RDONLY);
 	if (fd < 0) {
-		fprintf(stderr, "Failed to open %s device: %s\n", device_name, device_path);
+		log_device(LOG_ERR, device_name, -1, errno, "Failed to open %s device: %s", device_name, device_path);
 		return -1;
 	}
 	
 	if (ioctl(fd, EVIOCGRAB, 1) < 0) {
-		fprintf(stderr, "Failed to grab %s device\n", device_name);
+		log_device(LOG_ERR, device_name, fd, errno, "Failed to grab %s device", device_name);
 		close(fd);
 		return -1;
 	}
+
+	// Timestamp events with the monotonic clock so latency can be measured against CLOCK_MONOTONIC at write time
+	int clock_id = CLOCK_MONOTONIC;
+	if (ioctl(fd, EVIOCSCLOCKID, &clock_id) < 0) {
+		log_device(LOG_WARNING, device_name, fd, errno, "Failed to set %s device clock, latency measurements will be wrong", device_name);
+	}
 	
 	return fd;
 }
 
-// Helper function to find, open and grab an input device by vendor and model IDs
-static int find_open_and_grab_device(const char* vendor_id, const char* model_id, const char* device_name) {
-	char* device_path = find_event_device(vendor_id, model_id, device_name);
-	if (!device_path) {
+// Helper function to find, open and grab an input device by its identifiers
+// Matches already grabbed (by the daemon or anything else) are skipped, config_load makes sure no two entries match the same devices
+static int find_open_and_grab_device(const usb_device_ids_t* ids, const char* device_name) {
+	sd_device_enumerator* enumerator = enumerate_event_devices(ids, device_name);
+	if (!enumerator) {
 		return -1;
 	}
-	
-	int fd = open_and_grab_device(device_path, device_name);
-	free(device_path);
-	
+
+	int fd = -1;
+	int found = 0;
+	for (sd_device* device = sd_device_enumerator_get_device_first(enumerator); device && fd < 0;
+	     device = sd_device_enumerator_get_device_next(enumerator)) {
+		const char* device_path = NULL;
+		if (sd_device_get_devname(device, &device_path) < 0) {
+			continue;
+		}
+		found = 1;
+		log_device(LOG_INFO, device_name, -1, 0, "%s device found: %s", device_name, device_path);
+		fd = open_and_grab_device(device_path, device_name);
+	}
+	if (!found) {
+		log_device(LOG_ERR, device_name, -1, 0, "%s device not found", device_name);
+	}
+	sd_device_enumerator_unref(enumerator);
+
 	return fd;
 }
 
@@ -120,227 +178,819 @@ static void release_and_close_device(int fd, const char* device_name) {
 	if (fd >= 0) {
 		ioctl(fd, EVIOCGRAB, 0);
 		close(fd);
-		fprintf(stderr, "Released and closed %s device (fd=%d)\n", device_name, fd);
+		log_device(LOG_INFO, device_name, fd, 0, "Released and closed %s device (fd=%d)", device_name, fd);
+	}
+}
+
+// Device hotplug
+// A udev monitor thread bumps a per-device generation (a futex word) whenever a matching event device is added,
+// so reconnecting waits for the device to reappear instead of sleeping and rescanning
+#define HOTPLUG_FALLBACK_RESCAN_INTERVAL 5 // Seconds, only used if the udev monitor can't be started
+#define MAX_INPUT_DEVICES (NUM_INPUT_DEVICES * MAX_DEVICES_PER_KIND)
+typedef struct {
+	const usb_device_ids_t* ids;
+	_Atomic uint32_t generation;
+} hotplug_watch_t;
+// One per configured device, mice first
+hotplug_watch_t hotplug_watches[MAX_INPUT_DEVICES];
+int num_hotplug_watches = 0;
+int hotplug_event_fd = -1; // eventfd signalled on every matching add, for the reactors
+
+static void hotplug_notify(int watch) {
+	atomic_fetch_add_explicit(&hotplug_watches[watch].generation, 1, memory_order_release);
+	syscall(SYS_futex, &hotplug_watches[watch].generation, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	if (hotplug_event_fd >= 0) {
+		uint64_t one = 1;
+		if (write(hotplug_event_fd, &one, sizeof(one)) != sizeof(one)) {
+			fprintf(stderr, "Failed to signal hotplug eventfd\n");
+		}
+	}
+}
+
+static uint32_t hotplug_generation(int watch) {
+	return atomic_load_explicit(&hotplug_watches[watch].generation, memory_order_acquire);
+}
+
+// Block until a matching device was added after `generation` was read
+static void hotplug_wait(int watch, uint32_t generation) {
+	while (hotplug_generation(watch) == generation) {
+		syscall(SYS_futex, &hotplug_watches[watch].generation, FUTEX_WAIT_PRIVATE, generation, NULL, NULL, 0);
+	}
+}
+
+// Whether an added device's udev properties, any of which may be NULL, match the configured identifiers
+static int hotplug_ids_match(const usb_device_ids_t* ids, const char* vendor_id, const char* model_id, const char* id_path) {
+	if (ids->id_path[0]) {
+		return id_path && strcmp(ids->id_path, id_path) == 0;
+	}
+	return vendor_id && model_id && strcmp(ids->vendor_id, vendor_id) == 0 && strcmp(ids->model_id, model_id) == 0;
+}
+
+static int hotplug_handler(sd_device_monitor* monitor, sd_device* device, void* userdata) {
+	sd_device_action_t action;
+	const char* sysname = NULL;
+	if (sd_device_get_action(device, &action) < 0 || action != SD_DEVICE_ADD ||
+	    sd_device_get_sysname(device, &sysname) < 0 || strncmp(sysname, "event", 5) != 0) {
+		return 0;
+	}
+
+	// Any of these may be missing, e.g. built-in keyboards have no USB identifiers
+	const char* vendor_id = NULL;
+	const char* model_id = NULL;
+	const char* id_path = NULL;
+	sd_device_get_property_value(device, "ID_USB_VENDOR_ID", &vendor_id);
+	sd_device_get_property_value(device, "ID_MODEL_ID", &model_id);
+	sd_device_get_property_value(device, "ID_PATH", &id_path);
+	for (int i = 0; i < num_hotplug_watches; i++) {
+		if (hotplug_ids_match(hotplug_watches[i].ids, vendor_id, model_id, id_path)) {
+			fprintf(stderr, "Device %s (%s:%s, %s) added\n", sysname, vendor_id ? vendor_id : "-", model_id ? model_id : "-",
+				id_path ? id_path : "-");
+			hotplug_notify(i);
+		}
+	}
+	return 0;
+}
+
+// Thread that watches udev for devices being plugged back in
+void* hotplug_thread_func(void* args_void) {
+	sd_event* event = NULL;
+	sd_device_monitor* monitor = NULL;
+	if (sd_event_new(&event) < 0 ||
+	    sd_device_monitor_new(&monitor) < 0 ||
+	    sd_device_monitor_filter_add_match_subsystem_devtype(monitor, "input", NULL) < 0 ||
+	    sd_device_monitor_attach_event(monitor, event) < 0 ||
+	    sd_device_monitor_start(monitor, hotplug_handler, NULL) < 0) {
+		fprintf(stderr, "Failed to start udev monitor, rescanning for devices every %d seconds instead\n", HOTPLUG_FALLBACK_RESCAN_INTERVAL);
+		sd_device_monitor_unref(monitor);
+		sd_event_unref(event);
+		while (1) {
+			sleep(HOTPLUG_FALLBACK_RESCAN_INTERVAL);
+			for (int i = 0; i < num_hotplug_watches; i++) {
+				hotplug_notify(i);
+			}
+		}
 	}
+
+	int r = sd_event_loop(event);
+	fprintf(stderr, "udev monitor stopped (%d)\n", r);
+	sd_device_monitor_unref(monitor);
+	sd_event_unref(event);
+	pthread_exit(NULL);
 }
 
-// Helper function to reopen device with retry logic
-static int reopen_device(int* fd, const char* vendor_id, const char* model_id, const char* device_name) {
-	fprintf(stderr, "%s fd appears invalid, attempting to reopen device\n", device_name);
+// Helper function to reopen a device, blocks until the device is back
+static void reopen_device(int* fd, int watch, const char* device_name) {
+	log_device(LOG_INFO, device_name, *fd, 0, "%s fd appears invalid, attempting to reopen device", device_name);
 	
 	// Release and close old fd
 	release_and_close_device(*fd, device_name);
 	*fd = -1;
 	
-	// Wait a bit before reopening
-	sleep(1);
+	while (1) {
+		// Read the generation before scanning, so an add that races with the scan still wakes us
+		uint32_t generation = hotplug_generation(watch);
+
+		// Try to find and reopen device
+		*fd = find_open_and_grab_device(hotplug_watches[watch].ids, device_name);
+		if (*fd >= 0) {
+			break;
+		}
+
+		log_device(LOG_WARNING, device_name, -1, 0, "Failed to reopen %s device, waiting for it to be plugged back in", device_name);
+		hotplug_wait(watch, generation);
+	}
 	
-	// Try to find and reopen device
-	*fd = find_open_and_grab_device(vendor_id, model_id, device_name);
-	if (*fd < 0) {
-		fprintf(stderr, "Failed to reopen %s device, will retry\n", device_name);
+	log_device(LOG_INFO, device_name, *fd, 0, "Successfully reopened and grabbed %s device", device_name);
+}
+
+// A grabbed evdev device as a source (see event_io.h), reconnecting through hotplug_watches[watch] after a failed read
+typedef struct {
+	device_source_t source;
+	int watch;
+} evdev_source_t;
+
+static ssize_t evdev_source_read(device_source_t* source, struct input_event* events, size_t max) {
+	ssize_t n = fd_source_read(source, events, max);
+	if (n == 0) {
+		// A grabbed device never runs out of events, it is gone
+		errno = ENODEV;
 		return -1;
 	}
-	
-	fprintf(stderr, "Successfully reopened and grabbed %s device\n", device_name);
+	return n;
+}
+
+static int evdev_source_reopen(device_source_t* source) {
+	reopen_device(&source->fd, ((evdev_source_t*)source->context)->watch, source->name);
+	return 0;
+}
+
+static void evdev_source_close(device_source_t* source) {
+	release_and_close_device(source->fd, source->name);
+	source->fd = -1;
+}
+
+// Find, open and grab the device watched by hotplug_watches[watch], returns 0 on success
+static int evdev_source_open(evdev_source_t* evdev, int watch, const char* device_name) {
+	int fd = find_open_and_grab_device(hotplug_watches[watch].ids, device_name);
+	if (fd < 0) {
+		return -1;
+	}
+	evdev->watch = watch;
+	evdev->source = (device_source_t){
+		.name = device_name,
+		.fd = fd,
+		.context = evdev,
+		.read = evdev_source_read,
+		.reopen = evdev_source_reopen,
+		.close = evdev_source_close,
+	};
 	return 0;
 }
 
-// Shared variables for inter-process communication
-sem_t kb_event_sem;
+// Real-time mode (--realtime)
+// The input threads run SCHED_FIFO, optionally pinned to a CPU, and the process is locked in memory with its hot pages pre-faulted,
+// so remapping isn't preempted by ordinary load or stalled on a page fault
+typedef enum {
+	RT_THREAD_MOUSE, // Also the --reactor and --io-uring thread
+	RT_THREAD_KB_INPUT,
+	RT_THREAD_KB_OUTPUT,
+	NUM_RT_THREADS,
+} rt_thread_id_t;
+#define RT_PREFAULT_STACK_SIZE (64 * 1024)
+int realtime_enabled = 0;
+int realtime_priorities[NUM_RT_THREADS] = { RT_PRIORITY_MOUSE, RT_PRIORITY_KB_INPUT, RT_PRIORITY_KB_OUTPUT };
+int realtime_cpus[NUM_RT_THREADS] = { RT_CPU_MOUSE, RT_CPU_KB_INPUT, RT_CPU_KB_OUTPUT };
+static const char* const rt_thread_names[NUM_RT_THREADS] = { "mouse", "keyboard input", "keyboard output" };
+
+// Touch the stack the hot loop will use, so it is resident (and locked) before the first event
+static void __attribute__((noinline)) prefault_stack(void) {
+	volatile unsigned char stack[RT_PREFAULT_STACK_SIZE];
+	for (size_t i = 0; i < sizeof(stack); i += 4096) {
+		stack[i] = 0;
+	}
+}
+
+// Lock current and future pages in memory, called once before the input threads start
+static void lock_memory(void) {
+	// MCL_ONFAULT locks pages as they are touched, so thread stacks aren't populated and locked in full
+	if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0) {
+		int err = errno;
+		fprintf(stderr, "Failed to lock memory (check RLIMIT_MEMLOCK): errno=%d (%s)\n", err, get_errno_name(err));
+	}
+}
+
+// Apply real-time scheduling and CPU pinning to the calling thread, a no-op unless --realtime
+static void make_thread_realtime(rt_thread_id_t id) {
+	if (!realtime_enabled) {
+		return;
+	}
+
+	struct sched_param param = { .sched_priority = realtime_priorities[id] };
+	int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0) {
+		fprintf(stderr, "Failed to set SCHED_FIFO priority %d for %s thread (check RLIMIT_RTPRIO): errno=%d (%s)\n",
+			realtime_priorities[id], rt_thread_names[id], err, get_errno_name(err));
+	}
+
+	int cpu = realtime_cpus[id];
+	if (cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err != 0) {
+			fprintf(stderr, "Failed to pin %s thread to CPU %d: errno=%d (%s)\n", rt_thread_names[id], cpu, err, get_errno_name(err));
+		}
+	}
+
+	prefault_stack();
+}
+
+// Parse --realtime and --cpus, MOUSE[,KB_IN[,KB_OUT]] with every value in [min, max], threads left out keep their value
+// Returns 0 on success or -1 if anything is malformed, leaving `values` untouched
+static int parse_rt_thread_values(const char* arg, int min, int max, int* values) {
+	int parsed[NUM_RT_THREADS];
+	memcpy(parsed, values, sizeof(parsed));
+	const char* cursor = arg;
+	for (int i = 0; i < NUM_RT_THREADS; i++) {
+		char* end;
+		errno = 0;
+		long value = strtol(cursor, &end, 10);
+		if (end == cursor || errno != 0 || value < min || value > max) {
+			return -1;
+		}
+		parsed[i] = (int)value;
+		if (*end == '\0') {
+			memcpy(values, parsed, sizeof(parsed));
+			return 0;
+		}
+		if (*end != ',') {
+			return -1;
+		}
+		cursor = end + 1;
+	}
+	// More values than threads
+	return -1;
+}
+
+// Per-thread counters, see stats.h
+thread_stats_t all_thread_stats[MAX_STATS_THREADS];
+_Atomic int num_thread_stats = 0;
+_Thread_local thread_stats_t* thread_stats = NULL;
+
+// Per-thread log rings, see log.h
+log_ring_t log_rings[LOG_MAX_THREADS];
+_Atomic int log_num_rings = 0;
+_Atomic bool log_thread_running = false;
+_Thread_local log_ring_t* thread_log_ring = NULL;
+bool log_to_journal = false;
+_Atomic uint32_t log_trace_every = 0;
+_Thread_local uint32_t log_trace_skipped = 0;
+
+// USDT probe semaphores, see probes.h
+PROBE_SEMAPHORE_DEFINE(read)
+PROBE_SEMAPHORE_DEFINE(remap)
+PROBE_SEMAPHORE_DEFINE(enqueue)
+PROBE_SEMAPHORE_DEFINE(dequeue)
+PROBE_SEMAPHORE_DEFINE(write)
+
+// Epoch counters of the threads reading input_tables_t, see rcu.h
+rcu_reader_t rcu_readers[RCU_MAX_READERS];
+_Atomic int rcu_num_readers = 0;
+
+// Where an event written to a virtual device came from
+typedef enum {
+	EVENT_SOURCE_KEYBOARD,          // Keyboard passthrough
+	EVENT_SOURCE_MOUSE,             // Mouse passthrough
+	EVENT_SOURCE_MOUSE_TO_KEYBOARD, // Mouse side buttons remapped to the keyboard
+	EVENT_NUM_SOURCES,
+} event_source_t;
+
+// Time from the kernel timestamping an event to the daemon writing it to a virtual device, per source
+static const char* const event_source_names[EVENT_NUM_SOURCES] = { "keyboard", "mouse", "mouse->keyboard" };
+latency_histogram_t latency_histograms[EVENT_NUM_SOURCES];
+
+// Record latency samples for events just written to a virtual device
+// Passthrough frames are sampled at their SYN_REPORT, remapped side buttons at the key event itself
+static void record_write_latency(const struct input_event* events, const uint8_t* sources, size_t count) {
+	uint64_t now = monotonic_now_ns();
+	for (size_t i = 0; i < count; i++) {
+		const struct input_event* ev = &events[i];
+		int sampled = sources[i] == EVENT_SOURCE_MOUSE_TO_KEYBOARD
+			? ev->type == EV_KEY
+			: ev->type == EV_SYN && ev->code == SYN_REPORT;
+		if (!sampled) {
+			continue;
+		}
+		uint64_t event_ns = (uint64_t)ev->time.tv_sec * 1000000000ull + (uint64_t)ev->time.tv_usec * 1000ull;
+		latency_record(&latency_histograms[sources[i]], now > event_ns ? now - event_ns : 0);
+	}
+}
+
+// Frame of events destined for a virtual device, flushed with a single write at SYN_REPORT
+#define UINPUT_FRAME_MAX 64
+typedef struct uring_backend uring_backend_t;
+typedef struct {
+	device_sink_t* sink;
+	const char* device_name;
+	virtual_device_id_t device;
+	uring_backend_t* uring; // Flush through io_uring instead of write() if set
+	size_t count;
+	struct input_event events[UINPUT_FRAME_MAX];
+	uint8_t sources[UINPUT_FRAME_MAX];
+} uinput_frame_t;
+
+static int uring_backend_queue_write(uring_backend_t* backend, const uinput_frame_t* frame);
+
+static void uinput_frame_flush(uinput_frame_t* frame) {
+	if (frame->count == 0) {
+		return;
+	}
+
+	size_t size = frame->count * sizeof(frame->events[0]);
+	if (frame->uring && frame->sink->fd >= 0 && uring_backend_queue_write(frame->uring, frame) == 0) {
+		// Failures are counted when the write completes
+		record_write_latency(frame->events, frame->sources, frame->count);
+		log_trace_events(frame->device_name, "write", frame->events, frame->count);
+		probe_write(frame->device_name, frame->events, frame->count);
+		stats_count_io(&thread_stats->writes[frame->device], size, 0);
+		frame->count = 0;
+		return;
+	}
+
+	ssize_t written = frame->sink->write(frame->sink, frame->events, frame->count);
+	written = written > 0 ? written * (ssize_t)sizeof(frame->events[0]) : written;
+	stats_count_io(&thread_stats->writes[frame->device], written, written != (ssize_t)size);
+	if (written != (ssize_t)size) {
+		int err = errno;
+		log_event(LOG_ERR, frame->device_name, frame->sink->fd, err, &frame->events[0], "Failed to write %s frame of %zu events (first type=%d, code=%d): wrote %zd/%zu bytes, errno=%d (%s)",
+			frame->device_name, frame->count, frame->events[0].type, frame->events[0].code, written, size, err, get_errno_name(err));
+	}
+	record_write_latency(frame->events, frame->sources, frame->count);
+	log_trace_events(frame->device_name, "write", frame->events, frame->count);
+	probe_write(frame->device_name, frame->events, frame->count);
+	frame->count = 0;
+}
+
+static inline void uinput_frame_append(uinput_frame_t* frame, const struct input_event* ev, event_source_t source) {
+	if (frame->count == UINPUT_FRAME_MAX) {
+		// Unusually long frame, flush early rather than drop events
+		uinput_frame_flush(frame);
+	}
+	frame->sources[frame->count] = source;
+	frame->events[frame->count++] = *ev;
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		uinput_frame_flush(frame);
+	}
+}
+
+// Lock-free queue for keyboard events, produced by the keyboard INPUT and mouse IO threads
+// Sized from the peak depth measured by bench/pipeline_bench (g502d_kb_queue_high_water, sampled at every push):
+// typing bursts and side button chords peak at 3 to 6 events, while the unpaced kb-flood fills any size tried from 64 to 1024
+// with no change in throughput or latency. 256 slots (8 KB, small enough to stay in L1) are 40 times the realistic peak,
+// anything beyond that is a stalled OUTPUT thread, which --overflow handles rather than a bigger buffer
+#define EVENT_BUFFER_SIZE 256
+_Alignas(CACHE_LINE_SIZE) kb_queue_slot_t kb_event_buffer[EVENT_BUFFER_SIZE];
+kb_queue_t kb_event_queue;
 
-// Ring buffer for keyboard events
-// The indices are atomic for weakly ordered architectures (e.g. ARM)
-#define EVENT_BUFFER_SIZE (1<<18)
-pthread_mutex_t kb_buffer_mutex = PTHREAD_MUTEX_INITIALIZER; // Mutex to protect buffer access
-struct input_event kb_event_buffer[EVENT_BUFFER_SIZE];
-size_t head = 0; // Keyboard INPUT thread (write index)
-size_t tail = 0; // Keyboard OUTPUT thread (read index)
+// What to do when the OUTPUT thread falls behind (--overflow)
+// Producers wait for space once the queue is full whatever the policy, as the event they hold may be a key release,
+// the policies differ in what they shed beforehand to keep the queue from filling up
+typedef enum {
+	KB_OVERFLOW_BLOCK,       // Shed nothing
+	KB_OVERFLOW_DROP_OLDEST, // The OUTPUT thread drops whole frames from the front of the queue, keeping their key releases
+	KB_OVERFLOW_COALESCE,    // Producers drop key repeats, the key is still held so they carry nothing new
+	NUM_KB_OVERFLOW_POLICIES,
+} kb_overflow_policy_t;
+static const char* const kb_overflow_policy_names[NUM_KB_OVERFLOW_POLICIES] = { "block", "drop-oldest", "coalesce" };
+kb_overflow_policy_t kb_overflow_policy = KB_OVERFLOW_POLICY;
+// Depth from which the policies start shedding events, the rest of the queue is headroom so producers rarely have to wait
+#define KB_OVERFLOW_THRESHOLD (EVENT_BUFFER_SIZE / 4 * 3)
 
 // Clear keyboard buffer by abandoning buffered events (called from INPUT thread)
 static void clear_keyboard_buffer(void) {
-	pthread_mutex_lock(&kb_buffer_mutex);
-	{
-		// Jump head forward to abandon buffered events
-		// Safe because we only READ tail and WRITE head (which we own)
-		head = tail;
-		
-		// Drain semaphore of stale posts
-		int sem_value;
-		sem_getvalue(&kb_event_sem, &sem_value);
-		while (sem_value > 0) {
-			sem_trywait(&kb_event_sem);
-			sem_getvalue(&kb_event_sem, &sem_value);
+	// The OUTPUT thread skips everything queued before this point
+	kb_queue_discard_pending(&kb_event_queue);
+	
+	log_printf(LOG_INFO, "Keyboard event buffer cleared");
+}
+
+// Raw events read from the grabbed devices are appended here with --record, NULL otherwise
+event_recorder_t* event_recorder = NULL;
+
+// Append events read from a grabbed device to the recording (--record), stopping it for good if a write fails
+static inline void record_events(uint8_t device, uint8_t index, const struct input_event* events, size_t count) {
+	if (event_recorder && recorder_write(event_recorder, device, index, events, count) < 0) {
+		int err = errno;
+		log_printf(LOG_ERR, "Failed to write recording, recording stopped: errno=%d (%s)", err, get_errno_name(err));
+	}
+}
+
+// Function to send input events to the keyboard event buffer for the OUTPUT thread to process
+static void send_input_events_to_keyboard(const struct input_event* events, size_t count, event_source_t source) {
+	// Whether the current frame so far only held dropped repeats, its SYN_REPORT is then dropped too
+	bool frame_shed = false;
+	for (size_t i = 0; i < count; i++) {
+		const struct input_event* ev = &events[i];
+		// Events queued ahead of this one, read once for the overflow policy, the high-water mark and the probe
+		size_t depth = kb_queue_depth(&kb_event_queue);
+		if (kb_overflow_policy == KB_OVERFLOW_COALESCE && depth >= KB_OVERFLOW_THRESHOLD) {
+			if (ev->type == EV_KEY && ev->value == 2) {
+				stats_add(&thread_stats->kb_overflow_coalesced, 1);
+				frame_shed = true;
+				continue;
+			}
+			if (frame_shed && ev->type == EV_SYN && ev->code == SYN_REPORT) {
+				frame_shed = false;
+				continue;
+			}
 		}
+		frame_shed = false;
+
+		while (!kb_queue_push(&kb_event_queue, ev, source)) {
+			// Full, wait rather than drop an event which may be a key release
+			stats_add(&thread_stats->kb_overflow_waits, 1);
+			kb_queue_wake_consumer(&kb_event_queue);
+			kb_queue_wait_space(&kb_event_queue);
+		}
+		// Sampled as events arrive, where the queue is deepest, rather than once the OUTPUT thread wakes to drain it
+		stats_max(&thread_stats->kb_queue_high_water, depth < EVENT_BUFFER_SIZE ? depth + 1 : EVENT_BUFFER_SIZE);
+		probe_enqueue(ev, source, depth);
 	}
-	pthread_mutex_unlock(&kb_buffer_mutex);
-	
-	fprintf(stderr, "Keyboard event buffer cleared\n");
+
+	// Wake the OUTPUT thread once if these events made the buffer non-empty
+	kb_queue_wake_consumer(&kb_event_queue);
 }
 
-// Function to send an input event to the keyboard event buffer for the OUTPUT thread to process
-static void send_input_event_to_keyboard(struct input_event* ev) {
-	pthread_mutex_lock(&kb_buffer_mutex);
-	{
-		// Add the event to the ring buffer
-		size_t next_head = (head + 1) % EVENT_BUFFER_SIZE;
-		int sem_value;
-		sem_getvalue(&kb_event_sem, &sem_value);
-		
-		if (next_head == tail)
-		{
-			// Buffer is full, this should never happen
-			fprintf(stderr, "Keyboard event buffer overflow detected (head=%zu, tail=%zu, sem_value=%d)\n", head, tail, sem_value);
-			fprintf(stderr, "Keyboard event buffer full, (type=%d, code=%d, value=%d)\n",
-				ev->type, ev->code, ev->value);
-			exit(1); 
-			return;
+static void send_input_event_to_keyboard(const struct input_event* ev, event_source_t source) {
+	send_input_events_to_keyboard(ev, 1, source);
+}
+
+// Number of events pulled from an event device per read(), a G502 report is only a few events
+#define READ_BATCH_SIZE 64
+
+// State for processing mouse events, shared by the threaded and reactor modes
+typedef struct {
+	// Sub-pixel remainders of scaled movement, in units of 1/2^DPI_SCALE_SHIFT pixels
+	int64_t accum_x;
+	int64_t accum_y;
+	// Raw movement of the current frame, scaled as a whole at SYN_REPORT so acceleration sees the frame's speed
+	int32_t motion_x;
+	int32_t motion_y;
+	uint64_t last_motion_us; // Timestamp of the last frame with movement, 0 if none since (re)connecting
+	// Coalescing (--coalesce), relative movement summed over frames held back until the next output interval
+	int32_t pending_rel[REL_CNT];
+	uint32_t pending_rel_mask; // Bit per REL_* code with a pending delta
+	struct input_event held_syn; // SYN_REPORT of the newest held frame, valid while `held`
+	bool held;
+	uint64_t last_emit_us; // CLOCK_MONOTONIC time the last frame was written
+	// Events for the virtual G502 are batched per frame
+	uinput_frame_t frame;
+	// Side button events go straight to this frame in reactor mode, or through the keyboard event buffer if NULL
+	uinput_frame_t* kb_frame;
+	// Whether the current mouse frame sent anything to the keyboard, which then needs a SYN_REPORT of its own
+	bool kb_frame_dirty;
+	// Buttons currently held and the mapping they were pressed with, so a reload between press and release can't leave a key stuck
+	uint64_t pressed_buttons[(KEY_CNT + 63) / 64];
+	key_remap_t pressed_as[KEY_CNT];
+	// Read-side epoch for input_tables_t
+	rcu_reader_t* rcu;
+} mouse_state_t;
+
+// Reset per-device state after the mouse reconnects
+static void reset_mouse_state(mouse_state_t* state) {
+	// Drop the partial frame, the device will resend its state after reconnecting
+	state->frame.count = 0;
+	// Reset accumulators on reconnect
+	state->accum_x = 0;
+	state->accum_y = 0;
+	state->motion_x = 0;
+	state->motion_y = 0;
+	state->last_motion_us = 0;
+	state->pending_rel_mask = 0;
+	state->held = false;
+	state->kb_frame_dirty = false;
+}
+
+// Minimum time between frames written to the virtual G502, 0 writes every frame as it arrives
+uint64_t mouse_coalesce_interval_us = COALESCE_RATE_HZ > 0 ? 1000000 / COALESCE_RATE_HZ : 0;
+
+// Add a relative delta to the frame being built, all REL_* events of a frame are appended together at SYN_REPORT
+static inline void mouse_emit_rel(mouse_state_t* state, const struct input_event* ev) {
+	if (ev->code >= REL_CNT) {
+		uinput_frame_append(&state->frame, ev, EVENT_SOURCE_MOUSE);
+		return;
+	}
+	if (!(state->pending_rel_mask & (1u << ev->code))) {
+		state->pending_rel[ev->code] = 0;
+		state->pending_rel_mask |= 1u << ev->code;
+	}
+	state->pending_rel[ev->code] += ev->value;
+}
+
+// Append the pending deltas and `syn` to the frame, writing it
+static void mouse_emit_frame(mouse_state_t* state, const struct input_event* syn) {
+	struct input_event ev = *syn;
+	ev.type = EV_REL;
+	while (state->pending_rel_mask) {
+		ev.code = __builtin_ctz(state->pending_rel_mask);
+		ev.value = state->pending_rel[ev.code];
+		state->pending_rel_mask &= state->pending_rel_mask - 1;
+		if (ev.value != 0) {
+			uinput_frame_append(&state->frame, &ev, EVENT_SOURCE_MOUSE);
 		}
+	}
+	uinput_frame_append(&state->frame, syn, EVENT_SOURCE_MOUSE);
+	state->held = false;
+	if (mouse_coalesce_interval_us) {
+		state->last_emit_us = monotonic_now_ns() / 1000;
+	}
+}
 
-		kb_event_buffer[head] = *ev;
-		head = next_head;
+// Decide whether to hold back the frame ending with `syn` to merge it with later ones
+// Only frames carrying nothing but movement are held, anything else (buttons) goes out at once together with the held movement
+static bool mouse_coalesce_hold(mouse_state_t* state, const struct input_event* syn) {
+	if (mouse_coalesce_interval_us == 0 || state->frame.count != 0) {
+		return false;
 	}
-	pthread_mutex_unlock(&kb_buffer_mutex);
+	if (monotonic_now_ns() / 1000 - state->last_emit_us >= mouse_coalesce_interval_us) {
+		return false;
+	}
+	state->held_syn = *syn;
+	state->held = true;
+	return true;
+}
 
-	// Signal that a new event is available
-	if (sem_post(&kb_event_sem) != 0)
-	{
-		fprintf(stderr, "sem_post failed when sending keyboard event\n");
+// CLOCK_MONOTONIC time (us) at which held movement is due, or 0 if nothing is held
+static inline uint64_t mouse_coalesce_deadline_us(const mouse_state_t* state) {
+	return state->held ? state->last_emit_us + mouse_coalesce_interval_us : 0;
+}
+
+// Write held movement once its deadline passed without another frame arriving
+static void mouse_coalesce_flush(mouse_state_t* state) {
+	if (state->held) {
+		mouse_emit_frame(state, &state->held_syn);
 	}
 }
 
-// Thread that will handle mouse INPUT and OUTPUT events
+// Everything the hot path reads from the config, rebuilt as a whole and swapped in on reload
+// Readers load the pointer once per batch of events inside an RCU read-side critical section (see rcu.h)
 typedef struct {
-	const char* vendor_id;
-	const char* model_id;
-	const int out_fd;
-} mouse_thread_args_t;
-void* mouse_thread_io_func(void* args_void) {
-	mouse_thread_args_t* args = (mouse_thread_args_t*)args_void;
+	remap_tables_t remap;
+	accel_table_t accel; // Scales in units of 1/2^DPI_SCALE_SHIFT
+} input_tables_t;
+_Atomic(input_tables_t*) active_input_tables;
 
-	// Find, open and grab the mouse event device
-	int mouse_fd = find_open_and_grab_device(args->vendor_id, args->model_id, "mouse");
-	if (mouse_fd < 0)
-	{
-		pthread_exit(NULL);
+// --accel, takes precedence over the config file
+int accel_profile_override = -1;
+
+static input_tables_t* build_input_tables(const daemon_config_t* config) {
+	input_tables_t* tables = malloc(sizeof(*tables));
+	if (!tables) {
+		fprintf(stderr, "Failed to allocate input tables\n");
+		return NULL;
+	}
+	tables->remap = config->remap;
+	// Evaluate the acceleration curve once, the hot path only indexes the table
+	accel_curve_t curve = config_accel_curve(config);
+	if (accel_profile_override >= 0) {
+		curve.profile = accel_profile_override;
 	}
+	accel_table_build(&tables->accel, &curve, llround(config->dpi_scale * (1 << DPI_SCALE_SHIFT)));
+	return tables;
+}
 
-	// Accumulators for scaled movement
-	float accum_x = 0.0;
-	float accum_y = 0.0;
-	
-	const size_t ev_size = sizeof(struct input_event);
+// Remap a button, releases and repeats use the mapping it was pressed with rather than the current one
+static inline key_remap_t mouse_remap_button(mouse_state_t* state, const remap_tables_t* remap, const struct input_event* ev) {
+	unsigned code = ev->code < KEY_CNT ? ev->code : 0;
+	uint64_t* word = &state->pressed_buttons[code / 64];
+	uint64_t bit = 1ull << (code % 64);
+	if (*word & bit) {
+		key_remap_t held = state->pressed_as[code];
+		if (ev->value == 0) {
+			*word &= ~bit;
+		}
+		return held;
+	}
+	key_remap_t mapped = *remap_key(remap, code);
+	if (ev->value != 0) {
+		*word |= bit;
+		state->pressed_as[code] = mapped;
+	}
+	return mapped;
+}
 
-	// Read events in a loop
-	int consecutive_failures = 0;
-	while (1) {
-		// Read an event
-		struct input_event ev = {0};
-		ssize_t n = read(mouse_fd, &ev, ev_size);
-		if (n != ev_size) {
-			int err = errno;
-			fprintf(stderr, "Failed to read mouse event: read returned %zd bytes, errno=%d (%s)\n",
-				n, err, get_errno_name(err));
-			fprintf(stderr, "  Mouse fd=%d, is_valid=%d, consecutive_failures=%d\n", 
-				mouse_fd, is_fd_valid(mouse_fd), consecutive_failures);
-			
-			// Always try to reopen on any read error
-			if (reopen_device(&mouse_fd, args->vendor_id, args->model_id, "mouse") == 0) {
-				consecutive_failures = 0;
-				// Reset accumulators on reconnect
-				accum_x = 0.0;
-				accum_y = 0.0;
-			} else {
-				consecutive_failures++;
-				sleep(5); // Wait before retrying
-			}
-			continue;
+// Scale a relative movement by scale / 2^DPI_SCALE_SHIFT, rounding to the nearest pixel
+// The exact remainder is carried in `accum`, so the total output never drifts from the total input times the scale
+static inline int32_t scale_rel_motion(int64_t* accum, int32_t value, int64_t scale) {
+	const int64_t one = (int64_t)1 << DPI_SCALE_SHIFT;
+	int64_t total = *accum + (int64_t)value * scale;
+	int64_t move = (total + (one >> 1)) >> DPI_SCALE_SHIFT; // Arithmetic shift, i.e. floor
+	*accum = total - move * one;
+	return (int32_t)move;
+}
+
+static inline void mouse_event_to_keyboard(mouse_state_t* state, const struct input_event* ev) {
+	if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+		// Only complete keyboard frames that have something in them, otherwise every mouse report would cost a keyboard write
+		if (!state->kb_frame_dirty) {
+			stats_add(&thread_stats->kb_syn_skipped, 1);
+			return;
 		}
-		
-		// Reset failure counter on successful read
-		consecutive_failures = 0;
+		state->kb_frame_dirty = false;
+	} else {
+		state->kb_frame_dirty = true;
+	}
+
+	if (state->kb_frame) {
+		uinput_frame_append(state->kb_frame, ev, EVENT_SOURCE_MOUSE_TO_KEYBOARD);
+	} else {
+		send_input_event_to_keyboard(ev, EVENT_SOURCE_MOUSE_TO_KEYBOARD);
+	}
+}
+
+// Accelerate and scale the movement of the frame ending with `syn`, and add it to the pending deltas
+static void flush_mouse_motion(mouse_state_t* state, const input_tables_t* tables, const struct input_event* syn) {
+	if (state->motion_x == 0 && state->motion_y == 0) {
+		return;
+	}
+
+	// Speed comes from the evdev timestamps between frames, so it is exact regardless of polling rate or batching
+	uint64_t now_us = (uint64_t)syn->time.tv_sec * 1000000ull + (uint64_t)syn->time.tv_usec;
+	uint64_t interval_us = now_us - state->last_motion_us;
+	if (state->last_motion_us == 0 || interval_us == 0 || interval_us > ACCEL_IDLE_US) {
+		interval_us = ACCEL_DEFAULT_INTERVAL_US;
+	}
+	state->last_motion_us = now_us;
+	int64_t scale = accel_table_scale(&tables->accel, state->motion_x, state->motion_y, interval_us);
 
+	struct input_event ev = *syn;
+	ev.type = EV_REL;
+	if (state->motion_x != 0) {
+		ev.code = REL_X;
+		ev.value = scale_rel_motion(&state->accum_x, state->motion_x, scale);
+		mouse_emit_rel(state, &ev);
+	}
+	if (state->motion_y != 0) {
+		ev.code = REL_Y;
+		ev.value = scale_rel_motion(&state->accum_y, state->motion_y, scale);
+		mouse_emit_rel(state, &ev);
+	}
+	state->motion_x = 0;
+	state->motion_y = 0;
+}
+
+// Remap a batch of events read from the mouse into frames for the virtual devices
+// Depends only on its arguments, the output goes to the state's frames and so to whatever sinks they write to
+// (and to the keyboard event buffer if kb_frame is NULL), only coalescing (--coalesce) reads the clock
+static void transform_mouse_events(mouse_state_t* state, const input_tables_t* tables, const struct input_event* events, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		struct input_event ev = events[i];
 		switch (ev.type)
 		{
 		case EV_KEY:
 		{
-			// Only send side buttons to keyboard, forward others to mouse
-			if (ev.code == BTN_SIDE || ev.code == BTN_EXTRA) {
-				// Convert side buttons to modifier keys
-				if      (ev.code == BTN_SIDE) ev.code = KEY_LEFTSHIFT;
-				else if (ev.code == BTN_EXTRA) ev.code = KEY_LEFTCTRL;
-				send_input_event_to_keyboard(&ev);
+			// Buttons remapped to keys (side buttons to modifiers by default) go to the keyboard, others to the mouse
+			key_remap_t remap = mouse_remap_button(state, &tables->remap, &ev);
+			uint16_t button = ev.code;
+			ev.code = remap.code;
+			probe_remap(&ev, button, remap.code, remap.target);
+			if (remap.target == REMAP_TARGET_KEYBOARD) {
+				mouse_event_to_keyboard(state, &ev);
 			} else {
-				ssize_t written = write(args->out_fd, &ev, ev_size);
-				if (written != ev_size) {
-					fprintf(stderr, "Failed to write mouse button event: wrote %zd/%zu bytes\n", written, ev_size);
-				}
+				uinput_frame_append(&state->frame, &ev, EVENT_SOURCE_MOUSE);
 			}
 		} break;
 		case EV_REL:
 		{
-			// Scale mouse movement
+			// Movement is scaled per frame in flush_mouse_motion, forward others (wheel) as they are
 			if (ev.code == REL_X) {
-				accum_x += ev.value * DPI_SCALE;
-				int int_move = (int)roundf(accum_x);
-				accum_x -= int_move;
-				ev.value = int_move;
+				state->motion_x += ev.value;
 			} else if (ev.code == REL_Y) {
-				accum_y += ev.value * DPI_SCALE;
-				int int_move = (int)roundf(accum_y);
-				accum_y -= int_move;
-				ev.value = int_move;
-			}
-			ssize_t written = write(args->out_fd, &ev, ev_size);
-			if (written != ev_size) {
-				fprintf(stderr, "Failed to write mouse REL event: wrote %zd/%zu bytes\n", written, ev_size);
+				state->motion_y += ev.value;
+			} else {
+				mouse_emit_rel(state, &ev);
 			}
 		} break;
 		case EV_MSC:
 		{
-			if (ev.code == MSC_SCAN) {
-				if (ev.value == SCAN_BTN_SIDE) {
-					ev.value = SCAN_KEY_SHIFT;
-					send_input_event_to_keyboard(&ev);
-				} else if (ev.value == SCAN_BTN_EXTRA) {
-					ev.value = SCAN_KEY_CTRL;
-					send_input_event_to_keyboard(&ev);
-				} else {
-					ssize_t written = write(args->out_fd, &ev, ev_size);
-					if (written != ev_size) {
-						fprintf(stderr, "Failed to write mouse MSC scan event: wrote %zd/%zu bytes\n", written, ev_size);
-					}
-				}
+			// Scan codes of remapped buttons follow them to the keyboard
+			uint32_t scan;
+			if (ev.code == MSC_SCAN && remap_scan(&tables->remap, (uint32_t)ev.value, &scan)) {
+				probe_remap(&ev, (uint32_t)ev.value, scan, REMAP_TARGET_KEYBOARD);
+				ev.value = (int32_t)scan;
+				mouse_event_to_keyboard(state, &ev);
 			} else {
-				ssize_t written = write(args->out_fd, &ev, ev_size);
-				if (written != ev_size) {
-					fprintf(stderr, "Failed to write mouse MSC event: wrote %zd/%zu bytes\n", written, ev_size);
-				}
+				uinput_frame_append(&state->frame, &ev, EVENT_SOURCE_MOUSE);
 			}
 		} break;
 		case EV_SYN:
 		{
-			// Write event to both buffers
-			send_input_event_to_keyboard(&ev);
-			ssize_t written = write(args->out_fd, &ev, ev_size);
-			if (written != ev_size) {
-				fprintf(stderr, "Failed to write mouse SYN event: wrote %zd/%zu bytes\n", written, ev_size);
+			// Write event to both buffers (the keyboard only if this frame sent it any events), this completes and flushes the mouse frame
+			mouse_event_to_keyboard(state, &ev);
+			if (ev.code == SYN_REPORT) {
+				flush_mouse_motion(state, tables, &ev);
+				if (!mouse_coalesce_hold(state, &ev)) {
+					mouse_emit_frame(state, &ev);
+				}
+			} else {
+				uinput_frame_append(&state->frame, &ev, EVENT_SOURCE_MOUSE);
 			}
 		} break;
 		default:
 		{
 			// Forward other events to mouse
-			ssize_t written = write(args->out_fd, &ev, ev_size);
-			if (written != ev_size) {
-				fprintf(stderr, "Failed to write mouse event (type=%d, code=%d): wrote %zd/%zu bytes\n", 
-					ev.type, ev.code, written, ev_size);
-			}
+			uinput_frame_append(&state->frame, &ev, EVENT_SOURCE_MOUSE);
 		} break;
 		}
 	}
+}
+
+// Remap a batch of events read from the mouse and forward them to the virtual devices, with the tables currently in use
+static void process_mouse_events(mouse_state_t* state, const struct input_event* events, size_t count) {
+	rcu_read_lock(state->rcu);
+	transform_mouse_events(state, atomic_load_explicit(&active_input_tables, memory_order_acquire), events, count);
+	rcu_read_unlock(state->rcu);
+}
+
+// Thread that will handle mouse INPUT and OUTPUT events
+typedef struct {
+	device_source_t* source; // The grabbed mouse in the daemon
+	device_sink_t* sink;     // The virtual G502
+} mouse_thread_args_t;
+void* mouse_thread_io_func(void* args_void) {
+	mouse_thread_args_t* args = (mouse_thread_args_t*)args_void;
+	device_source_t* source = args->source;
+	stats_register_thread();
+	log_register_thread();
+	make_thread_realtime(RT_THREAD_MOUSE);
+
+	mouse_state_t state = {
+		.frame = {
+			.sink = args->sink,
+			.device_name = "mouse",
+			.device = VIRTUAL_DEVICE_G502,
+		},
+		.kb_frame = NULL,
+		.rcu = rcu_register_reader(),
+	};
+	if (!state.rcu) {
+		if (source->close) {
+			source->close(source);
+		}
+		pthread_exit(NULL);
+	}
+
+	// Read events in a loop
+	struct input_event events[READ_BATCH_SIZE];
+	while (1) {
+		// With movement held back by coalescing, only block until it is due (sources in memory never block)
+		uint64_t deadline_us = mouse_coalesce_deadline_us(&state);
+		if (deadline_us && source->fd >= 0) {
+			uint64_t now_us = monotonic_now_ns() / 1000;
+			struct pollfd pfd = { .fd = source->fd, .events = POLLIN };
+			struct timespec timeout = { 0, 0 };
+			if (deadline_us > now_us) {
+				timeout.tv_sec = (deadline_us - now_us) / 1000000;
+				timeout.tv_nsec = (deadline_us - now_us) % 1000000 * 1000;
+			}
+			if (ppoll(&pfd, 1, &timeout, NULL) == 0) {
+				mouse_coalesce_flush(&state);
+				continue;
+			}
+		}
+
+		// Read as many events as are ready
+		ssize_t n = source->read(source, events, READ_BATCH_SIZE);
+		if (n == 0) {
+			break;
+		}
+		stats_count_io(&thread_stats->reads[INPUT_DEVICE_MOUSE], n > 0 ? n * (ssize_t)sizeof(events[0]) : n, n < 0);
+		if (n < 0) {
+			int err = errno;
+			log_device(LOG_ERR, source->name, source->fd, err, "Failed to read mouse event: errno=%d (%s), fd=%d, is_valid=%d",
+				err, get_errno_name(err), source->fd, is_fd_valid(source->fd));
+
+			// Always try to reopen on any read error
+			if (!source->reopen || source->reopen(source) < 0) {
+				break;
+			}
+			stats_add(&thread_stats->reconnects[INPUT_DEVICE_MOUSE], 1);
+			reset_mouse_state(&state);
+			continue;
+		}
+
+		record_events(INPUT_DEVICE_MOUSE, 0, events, n);
+		log_trace_events(source->name, "read", events, n);
+		probe_read(source->name, events, n);
+		process_mouse_events(&state, events, n);
+	}
 
-	// Release and close the mouse device
-	release_and_close_device(mouse_fd, "mouse");
+	// The stream ended, write out any held movement and release the mouse
+	mouse_coalesce_flush(&state);
+	if (source->close) {
+		source->close(source);
+	}
 
 	pthread_exit(NULL);
 }
@@ -348,128 +998,1068 @@ void* mouse_thread_io_func(void* args_void) {
 
 // Thread that will handle INPUT keyboard events
 typedef struct {
-	const char* vendor_id;
-	const char* model_id;
+	device_source_t* source; // The grabbed keyboard in the daemon
 } keyboard_thread_args_t;
 void* keyboard_process_i(void* args_void) {
 	keyboard_thread_args_t* args = (keyboard_thread_args_t*)args_void;
-
-	// Find, open and grab the keyboard event device
-	int kb_fd = find_open_and_grab_device(args->vendor_id, args->model_id, "keyboard");
-	if (kb_fd < 0) {
-		pthread_exit(NULL);
-	}
+	device_source_t* source = args->source;
+	stats_register_thread();
+	log_register_thread();
+	make_thread_realtime(RT_THREAD_KB_INPUT);
 
 	// Read events in a loop
-	int consecutive_failures = 0;
+	struct input_event events[READ_BATCH_SIZE];
 	while (1) {
-		struct input_event ev;
-		ssize_t n = read(kb_fd, &ev, sizeof(ev));
-		if (n != sizeof(ev)) {
+		// Read as many events as are ready
+		ssize_t n = source->read(source, events, READ_BATCH_SIZE);
+		if (n == 0) {
+			break;
+		}
+		stats_count_io(&thread_stats->reads[INPUT_DEVICE_KEYBOARD], n > 0 ? n * (ssize_t)sizeof(events[0]) : n, n < 0);
+		if (n < 0) {
 			int err = errno;
-			fprintf(stderr, "Failed to read keyboard event: read returned %zd bytes, errno=%d (%s)\n", 
-				n, err, get_errno_name(err));
-			fprintf(stderr, "  Keyboard fd=%d, is_valid=%d\n", kb_fd, is_fd_valid(kb_fd));
+			log_device(LOG_ERR, source->name, source->fd, err, "Failed to read keyboard event: errno=%d (%s), fd=%d, is_valid=%d",
+				err, get_errno_name(err), source->fd, is_fd_valid(source->fd));
 			
 			// Clear the buffer before reopening to avoid stale events
 			clear_keyboard_buffer();
 			
 			// Always try to reopen on any read error
-			if (reopen_device(&kb_fd, args->vendor_id, args->model_id, "keyboard") == 0) {
-				consecutive_failures = 0;
-			} else {
-				consecutive_failures++;
-				sleep(5); // Wait before retrying
+			if (!source->reopen || source->reopen(source) < 0) {
+				break;
 			}
+			stats_add(&thread_stats->reconnects[INPUT_DEVICE_KEYBOARD], 1);
 			continue;
 		}
 		
-		// Reset failure counter on successful read
-		consecutive_failures = 0;
-		
-		// Process the keyboard event here
-		send_input_event_to_keyboard(&ev);
+		// Process the keyboard events here
+		record_events(INPUT_DEVICE_KEYBOARD, 0, events, n);
+		log_trace_events(source->name, "read", events, n);
+		probe_read(source->name, events, n);
+		send_input_events_to_keyboard(events, n, EVENT_SOURCE_KEYBOARD);
 	}
 
 	// Release and close the keyboard device
-	release_and_close_device(kb_fd, "keyboard");
+	if (source->close) {
+		source->close(source);
+	}
 
 	pthread_exit(NULL);
 }
 
 // Thread that will handle OUTPUT keyboard events
+#define KB_OUTPUT_BATCH_SIZE 64
 typedef struct {
-	const int out_fd;
+	device_sink_t* sink; // The virtual keyboard
 } keyboard_output_thread_args_t;
+
+// Frame tracking for KB_OVERFLOW_DROP_OLDEST in the OUTPUT thread
+typedef struct {
+	bool at_frame_start; // The next popped event starts a frame
+	bool dropping;       // The current frame is being dropped
+	bool kept_release;   // A key release of the dropped frame was kept, so its SYN_REPORT must be too
+} kb_frame_dropper_t;
+
+// Whether to drop a popped event, the decision is taken per frame from the depth of the queue when it starts
+// Key releases are always kept, a key left pressed on the virtual keyboard would autorepeat until pressed again
+static bool kb_overflow_drop(kb_frame_dropper_t* dropper, const struct input_event* ev) {
+	bool syn = ev->type == EV_SYN && ev->code == SYN_REPORT;
+	if (dropper->at_frame_start) {
+		dropper->dropping = kb_overflow_policy == KB_OVERFLOW_DROP_OLDEST && kb_queue_depth(&kb_event_queue) >= KB_OVERFLOW_THRESHOLD;
+		dropper->kept_release = false;
+	}
+	dropper->at_frame_start = syn;
+	if (!dropper->dropping) {
+		return false;
+	}
+	if (ev->type == EV_KEY && ev->value == 0) {
+		dropper->kept_release = true;
+		return false;
+	}
+	if (syn && dropper->kept_release) {
+		return false;
+	}
+	stats_add(&thread_stats->kb_overflow_dropped, 1);
+	return true;
+}
 void* keyboard_process_o(void* args_void) {
 	keyboard_output_thread_args_t* args = (keyboard_output_thread_args_t*)args_void;
+	stats_register_thread();
+	log_register_thread();
+	make_thread_realtime(RT_THREAD_KB_OUTPUT);
 
 	// Write events in a loop
+	struct input_event batch[KB_OUTPUT_BATCH_SIZE];
+	uint8_t sources[KB_OUTPUT_BATCH_SIZE];
+	kb_frame_dropper_t dropper = { .at_frame_start = true };
 	while (1) {
-		// Wait for an event to be available
-		if (sem_wait(&kb_event_sem) != 0)
-		{
-			fprintf(stderr, "sem_wait failed in keyboard output thread\n");
+		// Wait for at least one event to be available
+		kb_queue_wait_nonempty(&kb_event_queue);
+
+		// Drain everything that is ready, forwarding it to the virtual keyboard device in as few writes as possible
+		// The queue may already be empty if the INPUT thread discarded stale events
+		size_t count = 0;
+		uint32_t source;
+		size_t popped = 0;
+		while (count < KB_OUTPUT_BATCH_SIZE && kb_queue_pop(&kb_event_queue, &batch[count], &source)) {
+			popped++;
+			probe_dequeue(&batch[count], source, kb_queue_depth(&kb_event_queue));
+			if (!kb_overflow_drop(&dropper, &batch[count])) {
+				sources[count++] = source;
+			}
+		}
+		if (popped) {
+			kb_queue_wake_producers(&kb_event_queue);
+		}
+		if (count == 0) {
 			continue;
 		}
-		// int sem_value;
-		// sem_getvalue(&kb_event_sem, &sem_value);
-		// fprintf(stderr, "Keyboard output thread woke up, semaphore value=%d\n", sem_value);
-
-		// Get the next event from the buffer
-		size_t current_tail = atomic_load(&tail);
-		struct input_event ev = kb_event_buffer[current_tail];
-		atomic_store(&tail, (current_tail + 1) % EVENT_BUFFER_SIZE);
 
-		// Forward the event to the virtual keyboard device
-		ssize_t written = write(args->out_fd, &ev, sizeof(ev));
-		if (written != sizeof(ev)) {
+		ssize_t written = args->sink->write(args->sink, batch, count);
+		written = written > 0 ? written * (ssize_t)sizeof(batch[0]) : written;
+		stats_count_io(&thread_stats->writes[VIRTUAL_DEVICE_KEYBOARD], written, written != (ssize_t)(count * sizeof(batch[0])));
+		if (written != (ssize_t)(count * sizeof(batch[0]))) {
 			int err = errno;
-			fprintf(stderr, "Failed to write keyboard event (type=%d, code=%d, value=%d): wrote %zd/%zu bytes, errno=%d (%s)\n",
-				ev.type, ev.code, ev.value, written, sizeof(ev), err, get_errno_name(err));
+			log_event(LOG_ERR, args->sink->name, args->sink->fd, err, &batch[0], "Failed to write %zu keyboard events (first type=%d, code=%d, value=%d): wrote %zd/%zu bytes, errno=%d (%s)",
+				count, batch[0].type, batch[0].code, batch[0].value, written, count * sizeof(batch[0]), err, get_errno_name(err));
 		}
+		record_write_latency(batch, sources, count);
+		log_trace_events(args->sink->name, "write", batch, count);
+		probe_write(args->sink->name, batch, count);
 	}
 
 	pthread_exit(NULL);
 }
 
+// Single-threaded reactor mode (--reactor)
+// Every grabbed device is serviced from one epoll loop which writes straight to both virtual devices,
+// so side button modifiers reach the virtual keyboard without any queueing or thread switches
+// Any number of mice and keyboards can be merged this way, each device builds its own frames so their events never interleave mid-frame
+typedef struct {
+	input_device_id_t kind;
+	uint8_t index; // Within its kind, in config file order
+	const usb_device_ids_t* ids;
+	char name[32]; // "mouse", "keyboard 2", ...
+	int fd;
+	uinput_frame_t kb_frame; // Keyboard events, typed on a keyboard or remapped from a mouse button
+	mouse_state_t mouse_state; // Mice only
+} reactor_device_t;
 
+typedef struct {
+	const usb_device_ids_t* devices[NUM_INPUT_DEVICES]; // num_devices of each kind, the first one is required at startup
+	size_t num_devices[NUM_INPUT_DEVICES];
+	// Virtual devices, the grabbed devices are read directly as epoll and io_uring need their fds
+	device_sink_t* v_g502;
+	device_sink_t* v_kb;
+} reactor_args_t;
 
-int main()
-{
-	fprintf(stderr, "Starting G502 daemon...\n");
-	sleep(1);
+// Indices used for the hotplug eventfd and coalescing timerfd alongside the input devices
+#define REACTOR_HOTPLUG MAX_INPUT_DEVICES
+#define REACTOR_COALESCE (MAX_INPUT_DEVICES + 1)
 
-	char* g502_event_device_path = find_event_device(G502_USB_VENDOR_ID_S, G502_MODEL_ID_S, "G502");
-	if (!g502_event_device_path) {
+// State shared by the epoll and io_uring reactors
+typedef struct {
+	reactor_device_t devices[MAX_INPUT_DEVICES];
+	uint32_t num_devices;
+	// Fires when held mouse movement is due (--coalesce), -1 if coalescing is off
+	int coalesce_timer_fd;
+	uint64_t coalesce_armed_us;
+	// Grabbed devices are switched to O_NONBLOCK, for the io_uring backend (see uring.h)
+	bool nonblocking_reads;
+} reactor_t;
+
+// Returns 0 on success
+static int reactor_set_nonblocking(reactor_device_t* dev) {
+	int flags = fcntl(dev->fd, F_GETFL);
+	if (flags < 0 || fcntl(dev->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		int err = errno;
+		log_device(LOG_ERR, dev->name, dev->fd, err, "Failed to make %s device non-blocking: errno=%d (%s)", dev->name, err, get_errno_name(err));
+		return -1;
+	}
+	return 0;
+}
+
+// Find, open and grab every event device
+static int reactor_init(reactor_t* reactor, const reactor_args_t* args) {
+	stats_register_thread();
+	log_register_thread();
+	make_thread_realtime(RT_THREAD_MOUSE);
+
+	memset(reactor, 0, sizeof(*reactor));
+	reactor->coalesce_timer_fd = -1;
+	// One reader for all mice, they are only ever processed one at a time
+	rcu_reader_t* rcu = rcu_register_reader();
+	if (!rcu) {
+		return -1;
+	}
+	for (int kind = 0; kind < NUM_INPUT_DEVICES; kind++) {
+		for (size_t i = 0; i < args->num_devices[kind]; i++) {
+			reactor_device_t* dev = &reactor->devices[reactor->num_devices++];
+			dev->kind = kind;
+			dev->index = i;
+			dev->ids = &args->devices[kind][i];
+			dev->fd = -1;
+			if (i == 0) {
+				snprintf(dev->name, sizeof(dev->name), "%s", input_device_names[kind]);
+			} else {
+				snprintf(dev->name, sizeof(dev->name), "%s %zu", input_device_names[kind], i + 1);
+			}
+			dev->kb_frame = (uinput_frame_t){
+				.sink = args->v_kb,
+				.device_name = "keyboard",
+				.device = VIRTUAL_DEVICE_KEYBOARD,
+			};
+			if (kind == INPUT_DEVICE_MOUSE) {
+				dev->mouse_state.frame = (uinput_frame_t){
+					.sink = args->v_g502,
+					.device_name = "mouse",
+					.device = VIRTUAL_DEVICE_G502,
+				};
+				dev->mouse_state.kb_frame = &dev->kb_frame;
+				dev->mouse_state.rcu = rcu;
+			}
+		}
+	}
+
+	if (mouse_coalesce_interval_us) {
+		reactor->coalesce_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+		if (reactor->coalesce_timer_fd < 0) {
+			int err = errno;
+			fprintf(stderr, "Failed to create coalescing timer: errno=%d (%s)\n", err, get_errno_name(err));
+			return -1;
+		}
+	}
+
+	for (uint32_t i = 0; i < reactor->num_devices; i++) {
+		reactor_device_t* dev = &reactor->devices[i];
+		dev->fd = find_open_and_grab_device(dev->ids, dev->name);
+		if (dev->fd >= 0) {
+			continue;
+		}
+		// Only the first device of each kind has to be there, any others are grabbed whenever udev reports them
+		if (dev->ids != args->devices[dev->kind]) {
+			log_device(LOG_INFO, dev->name, -1, 0, "Waiting for %s device to be plugged in", dev->name);
+			continue;
+		}
+		for (uint32_t j = 0; j < i; j++) {
+			release_and_close_device(reactor->devices[j].fd, reactor->devices[j].name);
+		}
+		if (reactor->coalesce_timer_fd >= 0) {
+			close(reactor->coalesce_timer_fd);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+static void reactor_release(reactor_t* reactor) {
+	for (uint32_t i = 0; i < reactor->num_devices; i++) {
+		release_and_close_device(reactor->devices[i].fd, reactor->devices[i].name);
+	}
+	if (reactor->coalesce_timer_fd >= 0) {
+		close(reactor->coalesce_timer_fd);
+	}
+}
+
+// Arm the coalescing timer for the earliest held mouse movement, a no-op while that deadline is unchanged
+static void reactor_arm_coalesce_timer(reactor_t* reactor) {
+	if (reactor->coalesce_timer_fd < 0) {
+		return;
+	}
+	uint64_t deadline_us = 0;
+	for (uint32_t i = 0; i < reactor->num_devices; i++) {
+		uint64_t due_us = reactor->devices[i].kind == INPUT_DEVICE_MOUSE ? mouse_coalesce_deadline_us(&reactor->devices[i].mouse_state) : 0;
+		if (due_us && (deadline_us == 0 || due_us < deadline_us)) {
+			deadline_us = due_us;
+		}
+	}
+	if (deadline_us == 0 || deadline_us == reactor->coalesce_armed_us) {
+		return;
+	}
+	struct itimerspec its = {
+		.it_value = { .tv_sec = deadline_us / 1000000, .tv_nsec = deadline_us % 1000000 * 1000 },
+	};
+	if (timerfd_settime(reactor->coalesce_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		// Held movement then goes out with the next frame instead
+		int err = errno;
+		log_printf(LOG_ERR, "Failed to arm coalescing timer: errno=%d (%s)", err, get_errno_name(err));
+		return;
+	}
+	reactor->coalesce_armed_us = deadline_us;
+}
+
+// Write the held movement of every mouse whose deadline has passed, once the coalescing timer fired
+static void reactor_coalesce_flush(reactor_t* reactor) {
+	uint64_t now_us = monotonic_now_ns() / 1000;
+	for (uint32_t i = 0; i < reactor->num_devices; i++) {
+		reactor_device_t* dev = &reactor->devices[i];
+		if (dev->kind != INPUT_DEVICE_MOUSE) {
+			continue;
+		}
+		uint64_t due_us = mouse_coalesce_deadline_us(&dev->mouse_state);
+		if (due_us && due_us <= now_us) {
+			mouse_coalesce_flush(&dev->mouse_state);
+		}
+	}
+}
+
+static int reactor_watch_device(int epoll_fd, reactor_device_t* dev, uint32_t index) {
+	struct epoll_event ee = {
+		.events = EPOLLIN,
+		.data.u32 = index,
+	};
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dev->fd, &ee) < 0) {
+		int err = errno;
+		log_device(LOG_ERR, dev->name, dev->fd, err, "Failed to add %s device to epoll: errno=%d (%s)", dev->name, err, get_errno_name(err));
+		return -1;
+	}
+	return 0;
+}
+
+// Try once to reopen a missing device, returns 0 if it is back
+static int reactor_reopen_device(reactor_t* reactor, uint32_t index, int epoll_fd) {
+	reactor_device_t* dev = &reactor->devices[index];
+	dev->fd = find_open_and_grab_device(dev->ids, dev->name);
+	if (dev->fd < 0) {
+		return -1;
+	}
+	if ((reactor->nonblocking_reads && reactor_set_nonblocking(dev) < 0) ||
+	    (epoll_fd >= 0 && reactor_watch_device(epoll_fd, dev, index) < 0)) {
+		release_and_close_device(dev->fd, dev->name);
+		dev->fd = -1;
+		return -1;
+	}
+
+	log_device(LOG_INFO, dev->name, dev->fd, 0, "Successfully reopened and grabbed %s device", dev->name);
+	stats_add(&thread_stats->reconnects[dev->kind], 1);
+	return 0;
+}
+
+// Process the result of reading from a device, n is the read() return value (or -errno for io_uring)
+// Returns 0 on success, or -1 if the device failed and is now missing (fd is -1) until the next hotplug event
+static int reactor_handle_read(reactor_t* reactor, uint32_t index, const struct input_event* events, ssize_t n, int err, int epoll_fd) {
+	reactor_device_t* dev = &reactor->devices[index];
+
+	int failed = n <= 0 || n % sizeof(events[0]) != 0;
+	stats_count_io(&thread_stats->reads[dev->kind], n, failed);
+	if (failed) {
+		log_device(LOG_ERR, dev->name, dev->fd, err, "Failed to read %s event: read returned %zd bytes, errno=%d (%s), fd=%d, is_valid=%d",
+			dev->name, n, err, get_errno_name(err), dev->fd, is_fd_valid(dev->fd));
+
+		// Drop partial frames, the device will resend its state after reconnecting
+		if (dev->kind == INPUT_DEVICE_MOUSE) {
+			reset_mouse_state(&dev->mouse_state);
+		}
+		dev->kb_frame.count = 0;
+
+		// Always try to reopen on any read error, closing the old fd removes it from the epoll set
+		// If the device is gone, the other devices keep being serviced until udev reports this one again
+		log_device(LOG_INFO, dev->name, dev->fd, 0, "%s fd appears invalid, attempting to reopen device", dev->name);
+		release_and_close_device(dev->fd, dev->name);
+		dev->fd = -1;
+		if (reactor_reopen_device(reactor, index, epoll_fd) < 0) {
+			log_device(LOG_WARNING, dev->name, -1, 0, "Failed to reopen %s device, waiting for it to be plugged back in", dev->name);
+			return -1;
+		}
+		return 0;
+	}
+
+	size_t count = n / sizeof(events[0]);
+	record_events(dev->kind, dev->index, events, count);
+	log_trace_events(dev->name, "read", events, count);
+	probe_read(dev->name, events, count);
+	if (dev->kind == INPUT_DEVICE_MOUSE) {
+		process_mouse_events(&dev->mouse_state, events, count);
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			uinput_frame_append(&dev->kb_frame, &events[i], EVENT_SOURCE_KEYBOARD);
+		}
+	}
+	return 0;
+}
+
+// Try to reopen every missing device after a hotplug event
+// Returns a bitmask of the devices that are back
+static uint32_t reactor_reopen_missing(reactor_t* reactor, int epoll_fd) {
+	uint32_t reopened = 0;
+	for (uint32_t i = 0; i < reactor->num_devices; i++) {
+		if (reactor->devices[i].fd < 0 && reactor_reopen_device(reactor, i, epoll_fd) == 0) {
+			reopened |= 1u << i;
+		}
+	}
+	return reopened;
+}
+
+static int run_reactor(const reactor_args_t* args) {
+	// Static as it holds a frame per device, too much to keep on the pre-faulted stack
+	static reactor_t reactor;
+	if (reactor_init(&reactor, args) < 0) {
+		return -1;
+	}
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		fprintf(stderr, "Failed to create epoll instance\n");
+		reactor_release(&reactor);
+		return -1;
+	}
+	for (uint32_t i = 0; i < reactor.num_devices; i++) {
+		if (reactor.devices[i].fd >= 0 && reactor_watch_device(epoll_fd, &reactor.devices[i], i) < 0) {
+			close(epoll_fd);
+			reactor_release(&reactor);
+			return -1;
+		}
+	}
+	struct epoll_event hotplug_ee = {
+		.events = EPOLLIN,
+		.data.u32 = REACTOR_HOTPLUG,
+	};
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, hotplug_event_fd, &hotplug_ee) < 0) {
+		fprintf(stderr, "Failed to add hotplug eventfd to epoll\n");
+		close(epoll_fd);
+		reactor_release(&reactor);
+		return -1;
+	}
+	struct epoll_event coalesce_ee = {
+		.events = EPOLLIN,
+		.data.u32 = REACTOR_COALESCE,
+	};
+	if (reactor.coalesce_timer_fd >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, reactor.coalesce_timer_fd, &coalesce_ee) < 0) {
+		fprintf(stderr, "Failed to add coalescing timer to epoll\n");
+		close(epoll_fd);
+		reactor_release(&reactor);
+		return -1;
+	}
+
+	fprintf(stderr, "Reactor running\n");
+
+	struct input_event events[READ_BATCH_SIZE];
+	while (1) {
+		struct epoll_event ready[MAX_INPUT_DEVICES + 2];
+		int num_ready = epoll_wait(epoll_fd, ready, MAX_INPUT_DEVICES + 2, -1);
+		if (num_ready < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			int err = errno;
+			fprintf(stderr, "epoll_wait failed: errno=%d (%s)\n", err, get_errno_name(err));
+			break;
+		}
+
+		for (int r = 0; r < num_ready; r++) {
+			uint32_t index = ready[r].data.u32;
+
+			if (index == REACTOR_HOTPLUG) {
+				uint64_t count;
+				if (read(hotplug_event_fd, &count, sizeof(count)) == sizeof(count)) {
+					reactor_reopen_missing(&reactor, epoll_fd);
+				}
+				continue;
+			}
+			if (index == REACTOR_COALESCE) {
+				uint64_t expirations;
+				if (read(reactor.coalesce_timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+					reactor_coalesce_flush(&reactor);
+				}
+				continue;
+			}
+
+			// Read as many events as are ready, evdev only ever returns whole events
+			ssize_t n = read(reactor.devices[index].fd, events, sizeof(events));
+			reactor_handle_read(&reactor, index, events, n, errno, epoll_fd);
+		}
+		reactor_arm_coalesce_timer(&reactor);
+	}
+
+	close(epoll_fd);
+	reactor_release(&reactor);
+	return -1;
+}
+
+// io_uring backend (--io-uring)
+// Same single-threaded design as the epoll reactor, but reads from both devices and writes to both virtual devices
+// are submissions on one ring, so a steady-state report costs a single io_uring_enter() instead of epoll_wait(), read() and write()
+#define URING_ENTRIES 32
+#define URING_WRITE_SLOTS 16
+#define URING_OP_READ  (1ull << 32)
+#define URING_OP_WRITE (2ull << 32)
+#define URING_OP_HOTPLUG (3ull << 32)
+#define URING_OP_COALESCE (4ull << 32)
+struct uring_backend {
+	uring_t ring;
+	// Frames stay in their slot until the write completes
+	struct input_event write_buffers[URING_WRITE_SLOTS][UINPUT_FRAME_MAX];
+	size_t write_sizes[URING_WRITE_SLOTS];
+	const uinput_frame_t* write_frames[URING_WRITE_SLOTS]; // For error reporting
+	uint32_t free_write_slots; // Bitmask
+	// The last write SQE not yet submitted, so consecutive writes to one virtual device can be linked to keep their order
+	struct io_uring_sqe* last_write_sqe;
+	unsigned last_write_sqe_tail;
+	int last_write_fd;
+	struct input_event read_buffers[MAX_INPUT_DEVICES][READ_BATCH_SIZE];
+	uint64_t hotplug_count;
+	uint64_t coalesce_expirations;
+};
+
+// Queue a write of the frame, returns -1 if it must be written synchronously instead
+static int uring_backend_queue_write(uring_backend_t* backend, const uinput_frame_t* frame) {
+	struct io_uring_sqe* sqe = NULL;
+	if (backend->free_write_slots == 0 || !(sqe = uring_get_sqe(&backend->ring))) {
+		// Submit everything queued so far, so the synchronous write can't overtake it
+		uring_submit_and_wait(&backend->ring, 0);
+		backend->last_write_sqe = NULL;
+		return -1;
+	}
+
+	int slot = __builtin_ctz(backend->free_write_slots);
+	backend->free_write_slots &= ~(1u << slot);
+	size_t size = frame->count * sizeof(frame->events[0]);
+	memcpy(backend->write_buffers[slot], frame->events, size);
+	backend->write_sizes[slot] = size;
+	backend->write_frames[slot] = frame;
+
+	// Writes to uinput never block, but link them anyway so the kernel can't reorder a frame after its successor
+	if (backend->last_write_sqe && backend->last_write_fd == frame->sink->fd &&
+	    backend->last_write_sqe_tail == backend->ring.sqe_tail - 1) {
+		backend->last_write_sqe->flags |= IOSQE_IO_LINK;
+	}
+	uring_prep_rw(sqe, IORING_OP_WRITE, frame->sink->fd, backend->write_buffers[slot], size, URING_OP_WRITE | slot);
+	backend->last_write_sqe = sqe;
+	backend->last_write_sqe_tail = backend->ring.sqe_tail;
+	backend->last_write_fd = frame->sink->fd;
+	return 0;
+}
+
+static int uring_backend_arm_read(uring_backend_t* backend, reactor_t* reactor, uint32_t index) {
+	struct io_uring_sqe* sqe = uring_get_sqe(&backend->ring);
+	if (!sqe) {
+		// Flush pending writes to make room, they complete later like any other write
+		uring_submit_and_wait(&backend->ring, 0);
+		sqe = uring_get_sqe(&backend->ring);
+		if (!sqe) {
+			log_device(LOG_ERR, reactor->devices[index].name, reactor->devices[index].fd, 0, "io_uring submission queue full, cannot read %s device", reactor->devices[index].name);
+			return -1;
+		}
+	}
+	if (index == REACTOR_HOTPLUG) {
+		uring_prep_rw(sqe, IORING_OP_READ, hotplug_event_fd, &backend->hotplug_count, sizeof(backend->hotplug_count), URING_OP_HOTPLUG);
+	} else if (index == REACTOR_COALESCE) {
+		uring_prep_rw(sqe, IORING_OP_READ, reactor->coalesce_timer_fd, &backend->coalesce_expirations,
+			sizeof(backend->coalesce_expirations), URING_OP_COALESCE);
+	} else {
+		uring_prep_rw(sqe, IORING_OP_READ, reactor->devices[index].fd, backend->read_buffers[index],
+			sizeof(backend->read_buffers[index]), URING_OP_READ | index);
+	}
+	return 0;
+}
+
+// Returns 1 if io_uring is unavailable so the caller can fall back, otherwise only returns (-1) on a fatal error
+static int run_uring_reactor(const reactor_args_t* args) {
+	static uring_backend_t backend;
+	int ret = uring_init(&backend.ring, URING_ENTRIES);
+	if (ret < 0) {
+		fprintf(stderr, "io_uring unavailable: errno=%d (%s)\n", -ret, get_errno_name(-ret));
 		return 1;
 	}
-	free(g502_event_device_path);
+	backend.free_write_slots = (1u << URING_WRITE_SLOTS) - 1;
 
-	char* keyboard_event_device_path = find_event_device(KB_USB_VENDOR_ID_S, KB_MODEL_ID_S, "Keyboard");
-	if (!keyboard_event_device_path) {
+	static reactor_t reactor;
+	if (reactor_init(&reactor, args) < 0) {
+		uring_exit(&backend.ring);
+		return -1;
+	}
+	reactor.nonblocking_reads = true;
+	for (uint32_t i = 0; i < reactor.num_devices; i++) {
+		reactor.devices[i].kb_frame.uring = &backend;
+		reactor.devices[i].mouse_state.frame.uring = &backend;
+		if (reactor.devices[i].fd >= 0 && reactor_set_nonblocking(&reactor.devices[i]) < 0) {
+			reactor_release(&reactor);
+			uring_exit(&backend.ring);
+			return -1;
+		}
+	}
+
+	for (uint32_t i = 0; i <= REACTOR_COALESCE; i++) {
+		if ((i < MAX_INPUT_DEVICES && (i >= reactor.num_devices || reactor.devices[i].fd < 0)) ||
+		    (i == REACTOR_COALESCE && reactor.coalesce_timer_fd < 0)) {
+			continue;
+		}
+		if (uring_backend_arm_read(&backend, &reactor, i) < 0) {
+			reactor_release(&reactor);
+			uring_exit(&backend.ring);
+			return -1;
+		}
+	}
+
+	fprintf(stderr, "io_uring reactor running\n");
+
+	while (1) {
+		// Submit queued writes and re-armed reads, then sleep until something completes
+		ret = uring_submit_and_wait(&backend.ring, 1);
+		if (ret < 0 && ret != -EINTR && ret != -EBUSY) {
+			fprintf(stderr, "io_uring_enter failed: errno=%d (%s)\n", -ret, get_errno_name(-ret));
+			break;
+		}
+		backend.last_write_sqe = NULL;
+
+		struct io_uring_cqe cqe;
+		while (uring_pop_cqe(&backend.ring, &cqe)) {
+			uint32_t index = (uint32_t)cqe.user_data;
+			if ((cqe.user_data & ~0xffffffffull) == URING_OP_WRITE) {
+				if (cqe.res != (int)backend.write_sizes[index]) {
+					const uinput_frame_t* frame = backend.write_frames[index];
+					int err = cqe.res < 0 ? -cqe.res : 0;
+					log_event(LOG_ERR, frame->device_name, frame->sink->fd, err, &frame->events[0], "Failed to write %s frame: wrote %d/%zu bytes, errno=%d (%s)",
+						frame->device_name, cqe.res < 0 ? 0 : cqe.res, backend.write_sizes[index], err, get_errno_name(err));
+					stats_add(&thread_stats->writes[frame->device].failures, 1);
+				}
+				backend.free_write_slots |= 1u << index;
+			} else if ((cqe.user_data & ~0xffffffffull) == URING_OP_HOTPLUG) {
+				uint32_t reopened = reactor_reopen_missing(&reactor, -1);
+				for (uint32_t i = 0; i < reactor.num_devices; i++) {
+					if (reopened & (1u << i)) {
+						uring_backend_arm_read(&backend, &reactor, i);
+					}
+				}
+				uring_backend_arm_read(&backend, &reactor, REACTOR_HOTPLUG);
+			} else if ((cqe.user_data & ~0xffffffffull) == URING_OP_COALESCE) {
+				reactor_coalesce_flush(&reactor);
+				uring_backend_arm_read(&backend, &reactor, REACTOR_COALESCE);
+			} else if (cqe.res == -EAGAIN) {
+				// Woken with nothing left to read, the kernel normally retries internally before completing
+				uring_backend_arm_read(&backend, &reactor, index);
+			} else {
+				int err = cqe.res < 0 ? -cqe.res : 0;
+				// A device that failed and could not be reopened is re-armed after the next hotplug event
+				if (reactor_handle_read(&reactor, index, backend.read_buffers[index], cqe.res, err, -1) == 0) {
+					uring_backend_arm_read(&backend, &reactor, index);
+				}
+			}
+		}
+		reactor_arm_coalesce_timer(&reactor);
+	}
+
+	reactor_release(&reactor);
+	uring_exit(&backend.ring);
+	return -1;
+}
+
+// Config reloading (SIGHUP or the control socket's reload command)
+// The devices stay grabbed and the virtual devices are kept, only input_tables_t is rebuilt and swapped in
+char* config_file_path = NULL; // NULL if there is no config file location
+bool config_file_required = false;
+// Serialises reloads, never taken by the input loops
+pthread_mutex_t reload_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Keys enabled on each virtual device, they can't be changed once the device is created
+uint64_t virtual_key_bits[NUM_VIRTUAL_DEVICES][(KEY_CNT + 63) / 64];
+
+static int enable_virtual_key(virtual_device_id_t device, int fd, int code) {
+	if (ioctl(fd, UI_SET_KEYBIT, code) < 0) {
+		return -1;
+	}
+	virtual_key_bits[device][code / 64] |= 1ull << (code % 64);
+	return 0;
+}
+
+static void warn_unavailable_remaps(const remap_tables_t* remap) {
+	for (int code = 0; code < KEY_CNT; code++) {
+		const key_remap_t* mapped = remap_key(remap, code);
+		if (mapped->code == code && mapped->target == REMAP_TARGET_MOUSE) {
+			continue;
+		}
+		virtual_device_id_t device = mapped->target == REMAP_TARGET_KEYBOARD ? VIRTUAL_DEVICE_KEYBOARD : VIRTUAL_DEVICE_G502;
+		if (!(virtual_key_bits[device][mapped->code / 64] & (1ull << (mapped->code % 64)))) {
+			fprintf(stderr, "Button %d is remapped to code %d, which the %s virtual device was not created with, restart g502d to use it\n",
+				code, mapped->code, device == VIRTUAL_DEVICE_KEYBOARD ? "keyboard" : "G502");
+		}
+	}
+}
+
+// Re-read the config file and swap in new tables, returns 0 on success
+// On failure the running configuration is kept
+static int reload_config(void) {
+	pthread_mutex_lock(&reload_mutex);
+
+	static daemon_config_t config;
+	config_set_defaults(&config);
+	int ret = 0;
+	if (config_file_path) {
+		ret = config_load(&config, config_file_path, config_file_required);
+	}
+	input_tables_t* tables = ret == 0 ? build_input_tables(&config) : NULL;
+	if (tables) {
+		if (!config_devices_equal(&config, &daemon_config)) {
+			fprintf(stderr, "Device identifiers changed, restart g502d to apply them\n");
+		}
+		warn_unavailable_remaps(&tables->remap);
+
+		// Publish, then wait out readers that may still be using the old tables before freeing them
+		input_tables_t* old = atomic_exchange_explicit(&active_input_tables, tables, memory_order_acq_rel);
+		rcu_synchronize();
+		free(old);
+		fprintf(stderr, "Configuration reloaded\n");
+	} else {
+		fprintf(stderr, "Failed to reload configuration, keeping the current one\n");
+		ret = -1;
+	}
+
+	pthread_mutex_unlock(&reload_mutex);
+	return ret;
+}
+
+// Thread that reloads the config on SIGHUP, which every other thread has blocked
+void* reload_thread_func(void* args_void) {
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	while (1) {
+		int signal;
+		if (sigwait(&signals, &signal) == 0 && signal == SIGHUP) {
+			reload_config();
+		}
+	}
+
+	pthread_exit(NULL);
+}
+
+// Latency since startup, bucket upper bounds so accurate to within 12.5%
+static void print_latency_percentiles(void) {
+	for (int i = 0; i < EVENT_NUM_SOURCES; i++) {
+		const latency_histogram_t* histogram = &latency_histograms[i];
+		fprintf(stderr, "  %s latency: p50 %.1f us, p99 %.1f us, p99.9 %.1f us (%" PRIu64 " samples)\n",
+			event_source_names[i],
+			latency_percentile(histogram, 50.0) / 1e3,
+			latency_percentile(histogram, 99.0) / 1e3,
+			latency_percentile(histogram, 99.9) / 1e3,
+			latency_count(histogram));
+	}
+}
+
+// Thread that prints what the input and output threads log, see log.h
+void* log_thread_func(void* args_void) {
+	static log_ring_state_t states[LOG_MAX_THREADS];
+	const struct timespec interval = { 0, LOG_DRAIN_INTERVAL_NS };
+	while (1) {
+		nanosleep(&interval, NULL);
+		log_drain(states);
+	}
+
+	pthread_exit(NULL);
+}
+
+// Thread that prints write batching and latency statistics once per second (--stats)
+void* stats_thread_func(void* args_void) {
+	uint64_t last_events[NUM_VIRTUAL_DEVICES] = {0};
+	uint64_t last_writes[NUM_VIRTUAL_DEVICES] = {0};
+	uint64_t last_syn_skipped = 0;
+	uint64_t last_overflow[3] = {0};
+	while (1) {
+		sleep(1);
+		uint64_t events[NUM_VIRTUAL_DEVICES];
+		uint64_t writes[NUM_VIRTUAL_DEVICES];
+		uint64_t saved = 0;
+		for (int i = 0; i < NUM_VIRTUAL_DEVICES; i++) {
+			events[i] = stats_sum(offsetof(thread_stats_t, writes[i].events));
+			writes[i] = stats_sum(offsetof(thread_stats_t, writes[i].calls));
+			// Without batching every event would have cost one write() syscall
+			saved += (events[i] - last_events[i]) - (writes[i] - last_writes[i]);
+		}
+		// Empty keyboard frames that were never sent, each would have been a write of its own
+		uint64_t syn_skipped = stats_sum(offsetof(thread_stats_t, kb_syn_skipped));
+		fprintf(stderr, "Virtual G502: %" PRIu64 " events/s in %" PRIu64 " writes/s, virtual keyboard: %" PRIu64 " events/s in %" PRIu64 " writes/s, %" PRIu64 " write syscalls saved/s (%" PRIu64 " empty keyboard frames skipped/s)\n",
+			events[VIRTUAL_DEVICE_G502] - last_events[VIRTUAL_DEVICE_G502], writes[VIRTUAL_DEVICE_G502] - last_writes[VIRTUAL_DEVICE_G502],
+			events[VIRTUAL_DEVICE_KEYBOARD] - last_events[VIRTUAL_DEVICE_KEYBOARD], writes[VIRTUAL_DEVICE_KEYBOARD] - last_writes[VIRTUAL_DEVICE_KEYBOARD],
+			saved, syn_skipped - last_syn_skipped);
+		last_syn_skipped = syn_skipped;
+
+		// Only worth a line while the keyboard OUTPUT thread is falling behind
+		uint64_t overflow[3] = {
+			stats_sum(offsetof(thread_stats_t, kb_overflow_waits)),
+			stats_sum(offsetof(thread_stats_t, kb_overflow_dropped)),
+			stats_sum(offsetof(thread_stats_t, kb_overflow_coalesced)),
+		};
+		if (memcmp(overflow, last_overflow, sizeof(overflow)) != 0) {
+			fprintf(stderr, "  Keyboard buffer overflow: %" PRIu64 " waits/s, %" PRIu64 " events dropped/s, %" PRIu64 " repeats coalesced/s\n",
+				overflow[0] - last_overflow[0], overflow[1] - last_overflow[1], overflow[2] - last_overflow[2]);
+			memcpy(last_overflow, overflow, sizeof(overflow));
+		}
+		memcpy(last_events, events, sizeof(events));
+		memcpy(last_writes, writes, sizeof(writes));
+
+		print_latency_percentiles();
+	}
+
+	pthread_exit(NULL);
+}
+
+// Control socket under $XDG_RUNTIME_DIR serving live counters in the Prometheus text exposition format
+// Read it with e.g. `socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/g502d.sock`
+// Each connection gets one snapshot, built and sent from this thread only, so the hot loops never see it
+#define CONTROL_SOCKET_NAME "g502d.sock"
+#define CONTROL_SOCKET_COMMAND_TIMEOUT_MS 100
+static const char* const virtual_device_names[NUM_VIRTUAL_DEVICES] = { "virtual_g502", "virtual_keyboard" };
+
+static void write_io_metric(FILE* out, const char* name, const char* help, const char* const* device_names, int num_devices, size_t base, size_t stride, size_t field) {
+	fprintf(out, "# HELP g502d_%s %s\n# TYPE g502d_%s counter\n", name, help, name);
+	for (int i = 0; i < num_devices; i++) {
+		fprintf(out, "g502d_%s{device=\"%s\"} %" PRIu64 "\n", name, device_names[i], stats_sum(base + i * stride + field));
+	}
+}
+
+static void write_metrics(FILE* out) {
+	size_t reads = offsetof(thread_stats_t, reads);
+	size_t writes = offsetof(thread_stats_t, writes);
+	size_t stride = sizeof(io_counters_t);
+
+	write_io_metric(out, "events_read_total", "Events read from grabbed devices", input_device_names, NUM_INPUT_DEVICES, reads, stride, offsetof(io_counters_t, events));
+	write_io_metric(out, "bytes_read_total", "Bytes read from grabbed devices", input_device_names, NUM_INPUT_DEVICES, reads, stride, offsetof(io_counters_t, bytes));
+	write_io_metric(out, "reads_total", "read() syscalls (io_uring reads with --io-uring) on grabbed devices", input_device_names, NUM_INPUT_DEVICES, reads, stride, offsetof(io_counters_t, calls));
+	write_io_metric(out, "read_failures_total", "Failed reads on grabbed devices", input_device_names, NUM_INPUT_DEVICES, reads, stride, offsetof(io_counters_t, failures));
+	write_io_metric(out, "events_written_total", "Events written to virtual devices", virtual_device_names, NUM_VIRTUAL_DEVICES, writes, stride, offsetof(io_counters_t, events));
+	write_io_metric(out, "bytes_written_total", "Bytes written to virtual devices", virtual_device_names, NUM_VIRTUAL_DEVICES, writes, stride, offsetof(io_counters_t, bytes));
+	write_io_metric(out, "writes_total", "write() syscalls (io_uring writes with --io-uring) on virtual devices", virtual_device_names, NUM_VIRTUAL_DEVICES, writes, stride, offsetof(io_counters_t, calls));
+	write_io_metric(out, "write_failures_total", "Failed or short writes to virtual devices", virtual_device_names, NUM_VIRTUAL_DEVICES, writes, stride, offsetof(io_counters_t, failures));
+	write_io_metric(out, "reconnects_total", "Successful reopen_device() calls", input_device_names, NUM_INPUT_DEVICES, offsetof(thread_stats_t, reconnects), sizeof(_Atomic uint64_t), 0);
+
+	fprintf(out, "# HELP g502d_kb_queue_high_water Maximum depth of the keyboard event buffer\n# TYPE g502d_kb_queue_high_water gauge\n");
+	fprintf(out, "g502d_kb_queue_high_water %" PRIu64 "\n", stats_max_over_threads(offsetof(thread_stats_t, kb_queue_high_water)));
+
+	fprintf(out, "# HELP g502d_kb_syn_skipped_total Mouse SYN_REPORTs not forwarded to the virtual keyboard, each one a keyboard write saved\n# TYPE g502d_kb_syn_skipped_total counter\n");
+	fprintf(out, "g502d_kb_syn_skipped_total %" PRIu64 "\n", stats_sum(offsetof(thread_stats_t, kb_syn_skipped)));
+	fprintf(out, "# HELP g502d_kb_overflow_waits_total Times a producer waited for space in the full keyboard event buffer\n# TYPE g502d_kb_overflow_waits_total counter\n");
+	fprintf(out, "g502d_kb_overflow_waits_total %" PRIu64 "\n", stats_sum(offsetof(thread_stats_t, kb_overflow_waits)));
+	fprintf(out, "# HELP g502d_kb_overflow_dropped_total Keyboard events dropped with --overflow=drop-oldest\n# TYPE g502d_kb_overflow_dropped_total counter\n");
+	fprintf(out, "g502d_kb_overflow_dropped_total %" PRIu64 "\n", stats_sum(offsetof(thread_stats_t, kb_overflow_dropped)));
+	fprintf(out, "# HELP g502d_kb_overflow_coalesced_total Key repeats dropped with --overflow=coalesce\n# TYPE g502d_kb_overflow_coalesced_total counter\n");
+	fprintf(out, "g502d_kb_overflow_coalesced_total %" PRIu64 "\n", stats_sum(offsetof(thread_stats_t, kb_overflow_coalesced)));
+
+	// Quantiles are bucket upper bounds, accurate to within 12.5%
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	fprintf(out, "# HELP g502d_latency_seconds Time from kernel event timestamp to virtual device write\n# TYPE g502d_latency_seconds summary\n");
+	for (int i = 0; i < EVENT_NUM_SOURCES; i++) {
+		const latency_histogram_t* histogram = &latency_histograms[i];
+		for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+			fprintf(out, "g502d_latency_seconds{path=\"%s\",quantile=\"%g\"} %.9f\n",
+				event_source_names[i], quantiles[q], latency_percentile(histogram, quantiles[q] * 100.0) / 1e9);
+		}
+		fprintf(out, "g502d_latency_seconds_count{path=\"%s\"} %" PRIu64 "\n", event_source_names[i], latency_count(histogram));
+	}
+}
+
+static int open_control_socket(void) {
+	const char* runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!runtime_dir) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set, control socket disabled\n");
+		return -1;
+	}
+
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s", runtime_dir, CONTROL_SOCKET_NAME) >= (int)sizeof(addr.sun_path)) {
+		fprintf(stderr, "Control socket path too long, control socket disabled\n");
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to create control socket\n");
+		return -1;
+	}
+	// Remove a stale socket left behind by a previous instance
+	unlink(addr.sun_path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		int err = errno;
+		fprintf(stderr, "Failed to bind control socket %s: errno=%d (%s)\n", addr.sun_path, err, get_errno_name(err));
+		close(fd);
+		return -1;
+	}
+
+	fprintf(stderr, "Control socket listening on %s\n", addr.sun_path);
+	return fd;
+}
+
+// A client may send a command first, otherwise (nothing within the timeout, or EOF) it gets the metrics
+static void handle_control_request(int client_fd, FILE* out) {
+	char command[64];
+	ssize_t n = 0;
+	struct pollfd pfd = { .fd = client_fd, .events = POLLIN };
+	if (poll(&pfd, 1, CONTROL_SOCKET_COMMAND_TIMEOUT_MS) > 0) {
+		n = recv(client_fd, command, sizeof(command) - 1, 0);
+	}
+	if (n <= 0) {
+		write_metrics(out);
+		return;
+	}
+	command[n] = '\0';
+	command[strcspn(command, "\r\n")] = '\0';
+
+	if (strcmp(command, "reload") == 0) {
+		fprintf(out, reload_config() == 0 ? "ok\n" : "error, see the daemon's log\n");
+	} else if (strcmp(command, "metrics") == 0) {
+		write_metrics(out);
+	} else if (strncmp(command, "trace ", 6) == 0) {
+		// One in every N events, 0 stops tracing
+		char* end;
+		unsigned long every = strtoul(command + 6, &end, 10);
+		if (end == command + 6 || *end != '\0' || every > UINT32_MAX) {
+			fprintf(out, "invalid trace rate \"%s\"\n", command + 6);
+			return;
+		}
+		atomic_store_explicit(&log_trace_every, (uint32_t)every, memory_order_relaxed);
+		fprintf(out, "ok\n");
+	} else {
+		fprintf(out, "unknown command \"%s\", expected reload, metrics or trace N\n", command);
+	}
+}
+
+// Thread that serves the control socket
+void* control_socket_thread_func(void* args_void) {
+	int listen_fd = *(int*)args_void;
+
+	while (1) {
+		int client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd < 0) {
+			if (errno != EINTR) {
+				int err = errno;
+				fprintf(stderr, "Failed to accept control socket connection: errno=%d (%s)\n", err, get_errno_name(err));
+				sleep(1);
+			}
+			continue;
+		}
+
+		char* buffer = NULL;
+		size_t size = 0;
+		FILE* out = open_memstream(&buffer, &size);
+		if (out) {
+			handle_control_request(client_fd, out);
+			fclose(out);
+			// MSG_NOSIGNAL so a client hanging up early can't kill the daemon with SIGPIPE
+			for (size_t sent = 0; sent < size; ) {
+				ssize_t n = send(client_fd, buffer + sent, size - sent, MSG_NOSIGNAL);
+				if (n <= 0) {
+					break;
+				}
+				sent += n;
+			}
+			free(buffer);
+		}
+		close(client_fd);
+	}
+
+	pthread_exit(NULL);
+}
+
+// Replay mode (--replay)
+// Feeds a recording through the threaded mode's processing: mouse events through process_mouse_events() on this thread,
+// keyboard events through the keyboard event buffer and OUTPUT thread, either as fast as possible or at the recorded pace (--pace)
+// Timestamps keep the recorded spacing from the moment the replay starts, so acceleration sees the same speeds as it did live
+// and latency percentiles are meaningful with --pace
+// With fixed_times they start at REPLAY_FIXED_START_US instead, so two runs of the same recording produce identical output
+#define REPLAY_FIXED_START_US 1000000
+static void replay_feed(mouse_state_t* mice, uint8_t device, uint8_t index, const struct input_event* events, size_t count) {
+	stats_count_io(&thread_stats->reads[device], count * sizeof(events[0]), 0);
+	if (device == INPUT_DEVICE_MOUSE) {
+		process_mouse_events(&mice[index], events, count);
+	} else {
+		send_input_events_to_keyboard(events, count, EVENT_SOURCE_KEYBOARD);
+	}
+}
+
+// Returns the exit status for main()
+static int run_replay(const char* path, bool paced, bool fixed_times, device_sink_t* v_g502, keyboard_output_thread_args_t* kb_output_args) {
+	stats_register_thread();
+	uint64_t start_ns = monotonic_now_ns();
+	uint64_t base_us = fixed_times ? REPLAY_FIXED_START_US : start_ns / 1000;
+	device_source_t source;
+	replay_source_t replay;
+	if (replay_source_open(&source, &replay, path, path, base_us) < 0) {
 		return 1;
 	}
-	free(keyboard_event_device_path);
 
-	// Now we have verified the devices exist, create the virtual devices
-	
-	// Create virtual G502 device
+	pthread_t kb_output_thread;
+	if (pthread_create(&kb_output_thread, NULL, keyboard_process_o, kb_output_args) != 0) {
+		fprintf(stderr, "Failed to create keyboard output thread\n");
+		source.close(&source);
+		return 1;
+	}
+
+	// One state per recorded mouse, like the reactor's
+	static mouse_state_t mice[MAX_DEVICES_PER_KIND];
+	rcu_reader_t* rcu = rcu_register_reader();
+	for (int i = 0; i < MAX_DEVICES_PER_KIND; i++) {
+		mice[i].frame = (uinput_frame_t){
+			.sink = v_g502,
+			.device_name = "mouse",
+			.device = VIRTUAL_DEVICE_G502,
+		};
+		mice[i].rcu = rcu;
+	}
+
+	// The source returns events in batches like read() on each device would
+	struct input_event batch[READ_BATCH_SIZE];
+	uint64_t total = 0;
+	ssize_t n;
+	while ((n = source.read(&source, batch, READ_BATCH_SIZE)) > 0) {
+		if (replay.device >= NUM_INPUT_DEVICES || replay.index >= MAX_DEVICES_PER_KIND) {
+			fprintf(stderr, "Skipping %zd events from unknown device %u/%u in %s\n", n, replay.device, replay.index, path);
+			continue;
+		}
+		if (paced) {
+			// A batch ends with the frame's SYN_REPORT, it is due when that was read
+			uint64_t due_ns = start_ns + (record_event_time_us(&batch[n - 1]) - base_us) * 1000;
+			struct timespec due = { .tv_sec = due_ns / 1000000000, .tv_nsec = due_ns % 1000000000 };
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+			for (int i = 0; i < MAX_DEVICES_PER_KIND; i++) {
+				uint64_t deadline_us = mouse_coalesce_deadline_us(&mice[i]);
+				if (deadline_us && deadline_us <= monotonic_now_ns() / 1000) {
+					mouse_coalesce_flush(&mice[i]);
+				}
+			}
+		}
+		replay_feed(mice, replay.device, replay.index, batch, n);
+		total += n;
+	}
+	for (int i = 0; i < MAX_DEVICES_PER_KIND; i++) {
+		mouse_coalesce_flush(&mice[i]);
+	}
+	source.close(&source);
+
+	// Let the OUTPUT thread write out everything queued before reporting
+	while (!kb_queue_idle(&kb_event_queue)) {
+		usleep(1000);
+	}
+	double elapsed = (monotonic_now_ns() - start_ns) / 1e9;
+	fprintf(stderr, "Replayed %" PRIu64 " events in %.3f s (%.0f events/s)\n", total, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+	if (!fixed_times) {
+		print_latency_percentiles();
+	}
+	return 0;
+}
+
+// Create the virtual G502, returns its uinput fd or -1
+static int create_virtual_g502(void) {
 	int v_g502_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
 	if (v_g502_fd < 0) {
 		fprintf(stderr, "Failed to open /dev/uinput for virtual G502\n");
-		return 1;
+		return -1;
 	}
 	// Enable button events
 	if (ioctl(v_g502_fd, UI_SET_EVBIT, EV_KEY) < 0 ||
-	    ioctl(v_g502_fd, UI_SET_KEYBIT, BTN_LEFT) < 0 ||
-	    ioctl(v_g502_fd, UI_SET_KEYBIT, BTN_RIGHT) < 0 ||
-	    ioctl(v_g502_fd, UI_SET_KEYBIT, BTN_MIDDLE) < 0 ||
-	    ioctl(v_g502_fd, UI_SET_KEYBIT, KEY_LEFTSHIFT) < 0 ||
-	    ioctl(v_g502_fd, UI_SET_KEYBIT, KEY_LEFTCTRL) < 0) {
+	    enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, BTN_LEFT) < 0 ||
+	    enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, BTN_RIGHT) < 0 ||
+	    enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, BTN_MIDDLE) < 0 ||
+	    enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, KEY_LEFTSHIFT) < 0 ||
+	    enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, KEY_LEFTCTRL) < 0) {
 		fprintf(stderr, "Failed to set virtual G502 key bits\n");
 		close(v_g502_fd);
-		return 1;
+		return -1;
+	}
+	// Buttons remapped to other mouse buttons
+	for (int code = 0; code < KEY_CNT; code++) {
+		const key_remap_t* remap = remap_key(&daemon_config.remap, code);
+		if (remap->target == REMAP_TARGET_MOUSE && remap->code != code) {
+			enable_virtual_key(VIRTUAL_DEVICE_G502, v_g502_fd, remap->code);
+		}
 	}
 	// Enable relative events
 	if (ioctl(v_g502_fd, UI_SET_EVBIT, EV_REL) < 0 ||
@@ -478,14 +2068,14 @@ int main()
 	    ioctl(v_g502_fd, UI_SET_RELBIT, REL_WHEEL) < 0) {
 		fprintf(stderr, "Failed to set virtual G502 relative bits\n");
 		close(v_g502_fd);
-		return 1;
+		return -1;
 	}
 
 	struct uinput_setup v_g502_setup = {
 		.id = {
 			.bustype = BUS_USB,
-			.vendor  = G502_USB_VENDOR_ID,
-			.product = G502_MODEL_ID,
+			.vendor  = daemon_config.devices[INPUT_DEVICE_MOUSE][0].vendor,
+			.product = daemon_config.devices[INPUT_DEVICE_MOUSE][0].model,
 		},
 		.name = "Virtual G502 Hero",
 	};
@@ -493,38 +2083,47 @@ int main()
 	    ioctl(v_g502_fd, UI_DEV_CREATE) < 0) {
 		fprintf(stderr, "Failed to create virtual G502 device\n");
 		close(v_g502_fd);
-		return 1;
+		return -1;
 	}
-	fprintf(stderr, "Virtual G502 device created\n");	// Create virtual keyboard device
+	fprintf(stderr, "Virtual G502 device created\n");
+	return v_g502_fd;
+}
+
+// Create the virtual keyboard, returns its uinput fd or -1
+static int create_virtual_keyboard(void) {
 	int v_kb_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
 	if (v_kb_fd < 0) {
 		fprintf(stderr, "Failed to open /dev/uinput for virtual keyboard\n");
-		close(v_g502_fd);
-		return 1;
+		return -1;
 	}
 	// Enable key events (all keys from 0 to 255)
 	if (ioctl(v_kb_fd, UI_SET_EVBIT, EV_KEY) < 0) {
 		fprintf(stderr, "Failed to set virtual keyboard event bit\n");
 		close(v_kb_fd);
-		close(v_g502_fd);
-		return 1;
+		return -1;
 	}
 	for (int code = 0; code < 255; code++) {
-		ioctl(v_kb_fd, UI_SET_KEYBIT, code);
+		enable_virtual_key(VIRTUAL_DEVICE_KEYBOARD, v_kb_fd, code);
+	}
+	// Mouse buttons remapped to keys beyond that range
+	for (int code = 0; code < KEY_CNT; code++) {
+		const key_remap_t* remap = remap_key(&daemon_config.remap, code);
+		if (remap->target == REMAP_TARGET_KEYBOARD && remap->code >= 255) {
+			enable_virtual_key(VIRTUAL_DEVICE_KEYBOARD, v_kb_fd, remap->code);
+		}
 	}
 	// Enable MSC events for scan codes
 	if (ioctl(v_kb_fd, UI_SET_EVBIT, EV_MSC) < 0 ||
 	    ioctl(v_kb_fd, UI_SET_MSCBIT, MSC_SCAN) < 0) {
 		fprintf(stderr, "Failed to set virtual keyboard MSC bits\n");
 		close(v_kb_fd);
-		close(v_g502_fd);
-		return 1;
+		return -1;
 	}
 	struct uinput_setup v_kb_setup = {
 		.id = {
 			.bustype = BUS_USB,
-			.vendor  = KB_USB_VENDOR_ID,
-			.product = KB_MODEL_ID,
+			.vendor  = daemon_config.devices[INPUT_DEVICE_KEYBOARD][0].vendor,
+			.product = daemon_config.devices[INPUT_DEVICE_KEYBOARD][0].model,
 		},
 		.name = "Virtual Keyboard",
 	};
@@ -532,12 +2131,314 @@ int main()
 	    ioctl(v_kb_fd, UI_DEV_CREATE) < 0) {
 		fprintf(stderr, "Failed to create virtual keyboard device\n");
 		close(v_kb_fd);
+		return -1;
+	}
+	fprintf(stderr, "Virtual keyboard device created\n");
+	return v_kb_fd;
+}
+
+static void print_usage(const char* prog_name) {
+	fprintf(stderr, "Usage: %s [options]\n", prog_name);
+	fprintf(stderr, "  -f, --config=PATH  Config file for device identifiers and button remaps (default $XDG_CONFIG_HOME/g502d/%s)\n", CONFIG_FILE_NAME);
+	fprintf(stderr, "  -r, --reactor  Service every device from a single epoll thread instead of three worker threads (implied by several devices of a kind)\n");
+	fprintf(stderr, "  -u, --io-uring Like --reactor, but using io_uring for reads and writes (falls back to --reactor if unavailable)\n");
+	fprintf(stderr, "  -R, --realtime[=MOUSE[,KB_IN[,KB_OUT]]]  Run the input threads SCHED_FIFO at these priorities (default %d,%d,%d) and lock memory\n",
+		RT_PRIORITY_MOUSE, RT_PRIORITY_KB_INPUT, RT_PRIORITY_KB_OUTPUT);
+	fprintf(stderr, "      --cpus=MOUSE[,KB_IN[,KB_OUT]]  Pin the input threads to CPUs in --realtime mode, -1 leaves one unpinned\n");
+	fprintf(stderr, "  -a, --accel=PROFILE  Pointer acceleration profile: flat, linear, power or piecewise (see config.h)\n");
+	fprintf(stderr, "  -c, --coalesce=HZ  Merge mouse movement into at most HZ frames per second, 0 disables (default %d)\n", COALESCE_RATE_HZ);
+	fprintf(stderr, "  -o, --overflow=POLICY  When the keyboard event buffer backs up: block, drop-oldest or coalesce (default %s)\n",
+		kb_overflow_policy_names[KB_OVERFLOW_POLICY]);
+	fprintf(stderr, "      --record=FILE  Record the events read from the grabbed devices to FILE (written and flushed by the input threads, adding disk I/O to every batch)\n");
+	fprintf(stderr, "      --replay=FILE  Feed a recording through the event processing instead of grabbing the devices, then exit\n");
+	fprintf(stderr, "      --pace     Replay at the recorded pace rather than as fast as possible\n");
+	fprintf(stderr, "      --replay-output=PREFIX  Write the replayed output to PREFIX.mouse and PREFIX.keyboard instead of virtual devices\n");
+	fprintf(stderr, "      --trace=N  Log one in every N events read and written (change it later with \"trace N\" on the control socket)\n");
+	fprintf(stderr, "  -s, --stats    Print virtual device write and latency statistics every second\n");
+	fprintf(stderr, "  -h, --help     Show this help\n");
+}
+
+int main(int argc, char** argv)
+{
+	int print_stats = 0;
+	int reactor_mode = 0;
+	int uring_mode = 0;
+	const char* config_path = NULL;
+	const char* record_path = NULL;
+	const char* replay_path = NULL;
+	const char* replay_output = NULL;
+	bool replay_paced = false;
+	static const struct option long_options[] = {
+		{ "config", required_argument, NULL, 'f' },
+		{ "reactor", no_argument, NULL, 'r' },
+		{ "io-uring", no_argument, NULL, 'u' },
+		{ "realtime", optional_argument, NULL, 'R' },
+		{ "cpus", required_argument, NULL, 'C' },
+		{ "accel", required_argument, NULL, 'a' },
+		{ "coalesce", required_argument, NULL, 'c' },
+		{ "overflow", required_argument, NULL, 'o' },
+		{ "record", required_argument, NULL, 'W' },
+		{ "replay", required_argument, NULL, 'P' },
+		{ "replay-output", required_argument, NULL, 'O' },
+		{ "pace", no_argument, NULL, 'T' },
+		{ "trace", required_argument, NULL, 'X' },
+		{ "stats", no_argument, NULL, 's' },
+		{ "help",  no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "f:ruR::a:c:o:sh", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'f': config_path = optarg; break;
+		case 'r': reactor_mode = 1; break;
+		case 'u': uring_mode = 1; break;
+		case 'R':
+			realtime_enabled = 1;
+			if (optarg && parse_rt_thread_values(optarg, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), realtime_priorities) < 0) {
+				fprintf(stderr, "Invalid real-time priorities: %s (expected MOUSE[,KB_IN[,KB_OUT]], each %d-%d)\n",
+					optarg, sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO));
+				return 1;
+			}
+			break;
+		case 'C':
+			if (parse_rt_thread_values(optarg, -1, CPU_SETSIZE - 1, realtime_cpus) < 0) {
+				fprintf(stderr, "Invalid CPUs: %s (expected MOUSE[,KB_IN[,KB_OUT]], each -1-%d)\n", optarg, CPU_SETSIZE - 1);
+				return 1;
+			}
+			break;
+		case 'a':
+		{
+			int profile = accel_profile_from_name(optarg);
+			if (profile < 0) {
+				fprintf(stderr, "Unknown acceleration profile: %s\n", optarg);
+				return 1;
+			}
+			accel_profile_override = profile;
+		} break;
+		case 'c':
+		{
+			// Above 1 MHz the interval would round down to 0 us, which means off
+			char* end;
+			errno = 0;
+			long rate_hz = strtol(optarg, &end, 10);
+			if (end == optarg || *end != '\0' || errno != 0 || rate_hz < 0 || rate_hz > 1000000) {
+				fprintf(stderr, "Invalid coalescing rate: %s (expected 0-1000000 Hz)\n", optarg);
+				return 1;
+			}
+			mouse_coalesce_interval_us = rate_hz > 0 ? 1000000 / rate_hz : 0;
+		} break;
+		case 'o':
+		{
+			int policy;
+			for (policy = 0; policy < NUM_KB_OVERFLOW_POLICIES && strcmp(optarg, kb_overflow_policy_names[policy]) != 0; policy++);
+			if (policy == NUM_KB_OVERFLOW_POLICIES) {
+				fprintf(stderr, "Unknown overflow policy: %s\n", optarg);
+				return 1;
+			}
+			kb_overflow_policy = policy;
+		} break;
+		case 'W': record_path = optarg; break;
+		case 'P': replay_path = optarg; break;
+		case 'O': replay_output = optarg; break;
+		case 'T': replay_paced = true; break;
+		case 'X':
+		{
+			int every = atoi(optarg);
+			if (every < 0) {
+				fprintf(stderr, "Invalid trace rate: %s\n", optarg);
+				return 1;
+			}
+			atomic_store(&log_trace_every, every);
+		} break;
+		case 's': print_stats = 1; break;
+		case 'h': print_usage(argv[0]); return 0;
+		default: print_usage(argv[0]); return 1;
+		}
+	}
+
+	// Load the config file on top of the compiled-in defaults, the remap tables are built once here
+	config_set_defaults(&daemon_config);
+	config_file_path = config_path ? strdup(config_path) : config_default_path();
+	config_file_required = config_path != NULL;
+	if (config_file_path && config_load(&daemon_config, config_file_path, config_file_required) < 0) {
+		return 1;
+	}
+	atomic_store(&active_input_tables, build_input_tables(&daemon_config));
+	if (!atomic_load(&active_input_tables)) {
+		return 1;
+	}
+	// The threaded mode has one input thread per device, extra devices need the reactor
+	if ((daemon_config.num_devices[INPUT_DEVICE_MOUSE] > 1 || daemon_config.num_devices[INPUT_DEVICE_KEYBOARD] > 1) &&
+	    !reactor_mode && !uring_mode) {
+		fprintf(stderr, "Several devices of a kind configured, using the reactor\n");
+		reactor_mode = 1;
+	}
+
+	// Replay a recording instead of grabbing the devices
+	if (replay_path) {
+		int v_g502_fd;
+		int v_kb_fd;
+		if (replay_output) {
+			// Raw input_event streams, one file per virtual device, with fixed timestamps so runs can be compared with cmp
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s.mouse", replay_output);
+			v_g502_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			snprintf(path, sizeof(path), "%s.keyboard", replay_output);
+			v_kb_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if (v_g502_fd < 0 || v_kb_fd < 0) {
+				fprintf(stderr, "Failed to create replay output %s.mouse/.keyboard\n", replay_output);
+				return 1;
+			}
+		} else {
+			v_g502_fd = create_virtual_g502();
+			if (v_g502_fd < 0) {
+				return 1;
+			}
+			v_kb_fd = create_virtual_keyboard();
+			if (v_kb_fd < 0) {
+				close(v_g502_fd);
+				return 1;
+			}
+		}
+		kb_queue_init(&kb_event_queue, kb_event_buffer, EVENT_BUFFER_SIZE);
+		device_sink_t v_g502_sink;
+		device_sink_t v_kb_sink;
+		fd_sink_init(&v_g502_sink, "mouse", v_g502_fd);
+		fd_sink_init(&v_kb_sink, "keyboard", v_kb_fd);
+		keyboard_output_thread_args_t kb_output_args = {
+			.sink = &v_kb_sink,
+		};
+		int status = run_replay(replay_path, replay_paced, replay_output != NULL, &v_g502_sink, &kb_output_args);
+		close(v_kb_fd);
+		close(v_g502_fd);
+		return status;
+	}
+
+	// Record everything read from the grabbed devices
+	if (record_path) {
+		static event_recorder_t recorder;
+		if (recorder_open(&recorder, record_path) < 0) {
+			return 1;
+		}
+		event_recorder = &recorder;
+	}
+
+	// SIGHUP reloads the config, block it before any thread starts so only the reload thread receives it
+	sigset_t reload_signals;
+	sigemptyset(&reload_signals);
+	sigaddset(&reload_signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+
+	// Start logger thread before the threads that log through it
+	log_to_journal = log_stderr_is_journal();
+	pthread_t log_thread;
+	atomic_store(&log_thread_running, true);
+	if (pthread_create(&log_thread, NULL, log_thread_func, NULL) != 0) {
+		fprintf(stderr, "Failed to create logger thread, logging synchronously\n");
+		atomic_store(&log_thread_running, false);
+	}
+
+	fprintf(stderr, "Starting G502 daemon...\n");
+	sleep(1);
+
+	char* g502_event_device_path = find_event_device(&daemon_config.devices[INPUT_DEVICE_MOUSE][0], "G502");
+	if (!g502_event_device_path) {
+		return 1;
+	}
+	free(g502_event_device_path);
+
+	char* keyboard_event_device_path = find_event_device(&daemon_config.devices[INPUT_DEVICE_KEYBOARD][0], "Keyboard");
+	if (!keyboard_event_device_path) {
+		return 1;
+	}
+	free(keyboard_event_device_path);
+
+	// Now we have verified the devices exist, create the virtual devices
+	int v_g502_fd = create_virtual_g502();
+	if (v_g502_fd < 0) {
+		return 1;
+	}
+	int v_kb_fd = create_virtual_keyboard();
+	if (v_kb_fd < 0) {
+		close(v_g502_fd);
+		return 1;
+	}
+	device_sink_t v_g502_sink;
+	device_sink_t v_kb_sink;
+	fd_sink_init(&v_g502_sink, "mouse", v_g502_fd);
+	fd_sink_init(&v_kb_sink, "keyboard", v_kb_fd);
+
+	// Initialize keyboard event buffer
+	kb_queue_init(&kb_event_queue, kb_event_buffer, EVENT_BUFFER_SIZE);
+
+	// Start control socket thread, the daemon still runs without it
+	static int control_fd;
+	control_fd = open_control_socket();
+	pthread_t control_thread;
+	if (control_fd >= 0 && pthread_create(&control_thread, NULL, control_socket_thread_func, &control_fd) != 0) {
+		fprintf(stderr, "Failed to create control socket thread\n");
+		close(control_fd);
+	}
+
+	// Start reload thread, which waits for SIGHUP
+	pthread_t reload_thread;
+	if (pthread_create(&reload_thread, NULL, reload_thread_func, NULL) != 0) {
+		fprintf(stderr, "Failed to create reload thread, SIGHUP will be ignored\n");
+	}
+
+	// Lock memory before the input threads start, the keyboard event buffer is already resident as kb_queue_init touched every slot
+	if (realtime_enabled) {
+		lock_memory();
+	}
+
+	// Start hotplug thread, which wakes reconnecting devices as soon as udev reports them again
+	for (int kind = 0; kind < NUM_INPUT_DEVICES; kind++) {
+		for (size_t i = 0; i < daemon_config.num_devices[kind]; i++) {
+			hotplug_watches[num_hotplug_watches++].ids = &daemon_config.devices[kind][i];
+		}
+	}
+	if (reactor_mode || uring_mode) {
+		// Blocking, so io_uring waits on it rather than failing with EAGAIN (unlike the grabbed devices, see uring.h)
+		hotplug_event_fd = eventfd(0, EFD_CLOEXEC);
+		if (hotplug_event_fd < 0) {
+			fprintf(stderr, "Failed to create hotplug eventfd\n");
+			close(v_kb_fd);
+			close(v_g502_fd);
+			return 1;
+		}
+	}
+	pthread_t hotplug_thread;
+	if (pthread_create(&hotplug_thread, NULL, hotplug_thread_func, NULL) != 0) {
+		fprintf(stderr, "Failed to create hotplug thread\n");
+		close(v_kb_fd);
+		close(v_g502_fd);
+		return 1;
+	}
+
+	// Start statistics thread
+	pthread_t stats_thread;
+	if (print_stats && pthread_create(&stats_thread, NULL, stats_thread_func, NULL) != 0) {
+		fprintf(stderr, "Failed to create statistics thread\n");
+		close(v_kb_fd);
 		close(v_g502_fd);
 		return 1;
 	}
-	fprintf(stderr, "Virtual keyboard device created\n");	// Initialize semaphore for keyboard event buffer
-	if (sem_init(&kb_event_sem, 0, 0) != 0) {
-		fprintf(stderr, "Failed to initialize semaphore\n");
+
+	if (reactor_mode || uring_mode) {
+		reactor_args_t reactor_args = {
+			.devices = { daemon_config.devices[INPUT_DEVICE_MOUSE], daemon_config.devices[INPUT_DEVICE_KEYBOARD] },
+			.num_devices = { daemon_config.num_devices[INPUT_DEVICE_MOUSE], daemon_config.num_devices[INPUT_DEVICE_KEYBOARD] },
+			.v_g502 = &v_g502_sink,
+			.v_kb = &v_kb_sink,
+		};
+		if (!uring_mode || run_uring_reactor(&reactor_args) > 0) {
+			if (uring_mode) {
+				fprintf(stderr, "Falling back to the epoll reactor\n");
+			}
+			run_reactor(&reactor_args);
+		}
+
+		// The reactor only returns on a fatal error
 		close(v_kb_fd);
 		close(v_g502_fd);
 		return 1;
@@ -546,11 +2447,20 @@ int main()
 	// Start keyboard OUTPUT thread
 	pthread_t kb_output_thread;
 	keyboard_output_thread_args_t kb_output_args = {
-		.out_fd = v_kb_fd,
+		.sink = &v_kb_sink,
 	};
 	if (pthread_create(&kb_output_thread, NULL, keyboard_process_o, &kb_output_args) != 0) {
 		fprintf(stderr, "Failed to create keyboard output thread\n");
-		sem_destroy(&kb_event_sem);
+		close(v_kb_fd);
+		close(v_g502_fd);
+		return 1;
+	}
+
+	// Grab the devices, the first keyboard's watch comes after the mice
+	static evdev_source_t mouse_source;
+	static evdev_source_t kb_source;
+	if (evdev_source_open(&mouse_source, 0, "mouse") < 0 ||
+	    evdev_source_open(&kb_source, daemon_config.num_devices[INPUT_DEVICE_MOUSE], "keyboard") < 0) {
 		close(v_kb_fd);
 		close(v_g502_fd);
 		return 1;
@@ -559,12 +2469,10 @@ int main()
 	// Start keyboard INPUT thread
 	pthread_t kb_input_thread;
 	keyboard_thread_args_t kb_input_args = {
-		.vendor_id = KB_USB_VENDOR_ID_S,
-		.model_id = KB_MODEL_ID_S,
+		.source = &kb_source.source,
 	};
 	if (pthread_create(&kb_input_thread, NULL, keyboard_process_i, &kb_input_args) != 0) {
 		fprintf(stderr, "Failed to create keyboard input thread\n");
-		sem_destroy(&kb_event_sem);
 		close(v_kb_fd);
 		close(v_g502_fd);
 		return 1;
@@ -573,13 +2481,11 @@ int main()
 	// Start mouse IO thread
 	pthread_t mouse_io_thread;
 	mouse_thread_args_t mouse_io_args = {
-		.vendor_id = G502_USB_VENDOR_ID_S,
-		.model_id = G502_MODEL_ID_S,
-		.out_fd = v_g502_fd,
+		.source = &mouse_source.source,
+		.sink = &v_g502_sink,
 	};
 	if (pthread_create(&mouse_io_thread, NULL, mouse_thread_io_func, &mouse_io_args) != 0) {
 		fprintf(stderr, "Failed to create mouse IO thread\n");
-		sem_destroy(&kb_event_sem);
 		close(v_kb_fd);
 		close(v_g502_fd);
 		return 1;
@@ -591,7 +2497,6 @@ int main()
 	pthread_join(kb_output_thread, NULL);
 
 	// Cleanup and exit
-	sem_destroy(&kb_event_sem);
 	close(v_kb_fd);
 	close(v_g502_fd);
 
@@ -0,0 +1,202 @@
+#ifndef KB_QUEUE_H
+#define KB_QUEUE_H
+
+/*
+   Bounded lock-free multi-producer/single-consumer queue of input events.
+
+   Both the keyboard INPUT thread and the mouse IO thread produce into the queue, the keyboard OUTPUT thread consumes from it.
+   Each slot carries a sequence number (Dmitry Vyukov's bounded queue), so producers only contend on a single CAS of the head index and the consumer hands slots back through their sequence numbers instead of a lock.
+   The head and tail indices live on separate cache lines so producers and the consumer don't false-share.
+
+   The consumer sleeps on a single futex word. It only announces that it is asleep once it has drained the queue,
+   so producers only pay for a FUTEX_WAKE on the empty-to-non-empty transition, every other push stays in userspace.
+   A producer that finds the queue full can sleep on a second futex word the same way, the consumer only wakes it if it announced itself.
+*/
+
+#include <linux/futex.h>
+#include <limits.h>
+#include <linux/input.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CACHE_LINE_SIZE 64
+
+// 32 bytes on 64-bit, so two slots share a cache line and none straddles one
+// Sequence numbers are the low 32 bits of a position, compared with wrapping arithmetic
+typedef struct {
+	_Atomic uint32_t seq;
+	uint32_t source; // Opaque tag identifying the producer of the event
+	struct input_event ev;
+} kb_queue_slot_t;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) _Atomic size_t head; // Next position to claim (producers)
+	_Alignas(CACHE_LINE_SIZE) _Atomic size_t tail; // Next position to read (consumer)
+	_Atomic size_t discard_before;                 // Positions below this are stale (see kb_queue_discard_pending)
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint32_t consumer_sleeping; // Futex word, 1 while the consumer is (about to be) asleep
+	_Atomic uint32_t producers_waiting;            // Futex word, 1 while a producer waits for a free slot
+	_Alignas(CACHE_LINE_SIZE) size_t mask;         // Read-only after init
+	kb_queue_slot_t* slots;
+} kb_queue_t;
+
+// Initialise the queue over caller-provided storage, capacity must be a power of two (and below 2^31)
+static inline void kb_queue_init(kb_queue_t* q, kb_queue_slot_t* slots, size_t capacity) {
+	q->slots = slots;
+	q->mask = capacity - 1;
+	for (size_t i = 0; i < capacity; i++) {
+		atomic_store_explicit(&slots[i].seq, (uint32_t)i, memory_order_relaxed);
+	}
+	atomic_store_explicit(&q->head, 0, memory_order_relaxed);
+	atomic_store_explicit(&q->tail, 0, memory_order_relaxed);
+	atomic_store_explicit(&q->consumer_sleeping, 0, memory_order_relaxed);
+	atomic_store_explicit(&q->producers_waiting, 0, memory_order_relaxed);
+	atomic_store_explicit(&q->discard_before, 0, memory_order_release);
+}
+
+// Push an event, safe to call from any number of threads
+// Returns false if the queue is full
+static inline bool kb_queue_push(kb_queue_t* q, const struct input_event* ev, uint32_t source) {
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	kb_queue_slot_t* slot;
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		int32_t diff = (int32_t)(seq - (uint32_t)pos);
+		if (diff == 0) {
+			// Slot is free for this lap, try to claim it
+			if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// Slot still holds an event from the previous lap
+			return false;
+		} else {
+			// Another producer claimed this slot, reload and retry
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+
+	slot->ev = *ev;
+	slot->source = source;
+	atomic_store_explicit(&slot->seq, (uint32_t)(pos + 1), memory_order_release);
+	return true;
+}
+
+// Pop the oldest event, must only be called from the single consumer thread
+// Returns false if the queue is empty
+static inline bool kb_queue_pop(kb_queue_t* q, struct input_event* ev, uint32_t* source) {
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	for (;;) {
+		kb_queue_slot_t* slot = &q->slots[pos & q->mask];
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq != (uint32_t)(pos + 1)) {
+			if (atomic_load_explicit(&q->head, memory_order_acquire) == pos) {
+				return false;
+			}
+			// A producer has claimed this slot but not published it yet, this is a window of a few instructions
+			// Yield rather than return so a later, already published event can't be left behind without a wakeup
+			sched_yield();
+			continue;
+		}
+
+		*ev = slot->ev;
+		*source = slot->source;
+		atomic_store_explicit(&slot->seq, (uint32_t)(pos + q->mask + 1), memory_order_release);
+		atomic_store_explicit(&q->tail, pos + 1, memory_order_relaxed);
+
+		// Skip events abandoned by kb_queue_discard_pending
+		size_t discard_before = atomic_load_explicit(&q->discard_before, memory_order_acquire);
+		if ((intptr_t)(pos - discard_before) >= 0) {
+			return true;
+		}
+		pos++;
+	}
+}
+
+// Abandon every event pushed so far, the consumer skips them instead of forwarding them
+// Safe to call from any thread
+static inline void kb_queue_discard_pending(kb_queue_t* q) {
+	size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+	atomic_store_explicit(&q->discard_before, head, memory_order_release);
+}
+
+// Wake the consumer if it went to sleep on an empty queue, call after one or more pushes
+static inline void kb_queue_wake_consumer(kb_queue_t* q) {
+	// Pairs with the fence in kb_queue_wait_nonempty: either the consumer sees our event or we see it sleeping
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->consumer_sleeping, memory_order_relaxed) == 0) {
+		return;
+	}
+	// Only the first producer after the consumer fell asleep issues the wake
+	if (atomic_exchange_explicit(&q->consumer_sleeping, 0, memory_order_relaxed) == 1) {
+		syscall(SYS_futex, &q->consumer_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+// Block the consumer until the queue is non-empty
+static inline void kb_queue_wait_nonempty(kb_queue_t* q) {
+	for (;;) {
+		atomic_store_explicit(&q->consumer_sleeping, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		if (atomic_load_explicit(&q->head, memory_order_relaxed) != tail) {
+			atomic_store_explicit(&q->consumer_sleeping, 0, memory_order_relaxed);
+			return;
+		}
+		// Returns immediately (EAGAIN) if a producer already cleared the word, EINTR just loops
+		syscall(SYS_futex, &q->consumer_sleeping, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+// Block a producer until the consumer has freed a slot, for producers that must not drop the event they failed to push
+static inline void kb_queue_wait_space(kb_queue_t* q) {
+	for (;;) {
+		atomic_store_explicit(&q->producers_waiting, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		if (atomic_load_explicit(&q->head, memory_order_relaxed) - tail <= q->mask) {
+			return;
+		}
+		syscall(SYS_futex, &q->producers_waiting, FUTEX_WAIT_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+// Wake producers waiting in kb_queue_wait_space, call from the consumer after one or more pops
+static inline void kb_queue_wake_producers(kb_queue_t* q) {
+	// Pairs with the fence in kb_queue_wait_space: either the producer sees the freed slot or we see it waiting
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->producers_waiting, memory_order_relaxed) == 0) {
+		return;
+	}
+	if (atomic_exchange_explicit(&q->producers_waiting, 0, memory_order_relaxed) == 1) {
+		syscall(SYS_futex, &q->producers_waiting, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+// Whether the consumer drained the queue and went back to waiting, so everything pushed so far has been handled
+// Only meaningful once producers have stopped
+static inline bool kb_queue_idle(kb_queue_t* q) {
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	return atomic_load_explicit(&q->consumer_sleeping, memory_order_acquire) == 1 &&
+	       atomic_load_explicit(&q->head, memory_order_acquire) == tail;
+}
+
+// Approximate number of queued events, between 0 and the capacity (exact when called from the consumer with no concurrent pushes)
+static inline size_t kb_queue_depth(kb_queue_t* q) {
+	// Tail first, the consumer may advance it between the loads and past a head read before it, which would wrap
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	// Neither load orders against the other thread's stores, so clamp in case one is still stale
+	if ((intptr_t)(head - tail) <= 0) {
+		return 0;
+	}
+	return head - tail > q->mask + 1 ? q->mask + 1 : head - tail;
+}
+
+#endif // KB_QUEUE_H
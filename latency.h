@@ -0,0 +1,89 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+/*
+   Log-bucketed latency histogram (HDR style).
+
+   Values are bucketed by their most significant bit, with LATENCY_SUB_BUCKET_BITS bits of precision below it,
+   so every bucket is within 1/2^LATENCY_SUB_BUCKET_BITS (12.5%) of the values it holds, from nanoseconds up to a minute.
+   Each histogram must only be recorded into by a single thread, any thread may read percentiles from it.
+*/
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS     (1u << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT    35 // Values of 2^36 ns (~69 s) and above share the last bucket
+#define LATENCY_NUM_BUCKETS     ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) << LATENCY_SUB_BUCKET_BITS)
+
+typedef struct {
+	_Atomic uint64_t counts[LATENCY_NUM_BUCKETS];
+} latency_histogram_t;
+
+static inline unsigned latency_bucket_index(uint64_t value_ns) {
+	if (value_ns < LATENCY_SUB_BUCKETS) {
+		return (unsigned)value_ns;
+	}
+	unsigned exponent = 63 - __builtin_clzll(value_ns);
+	if (exponent > LATENCY_MAX_EXPONENT) {
+		return LATENCY_NUM_BUCKETS - 1;
+	}
+	unsigned sub_bucket = (value_ns >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+	return ((exponent - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS) | sub_bucket;
+}
+
+// Largest value that falls into the bucket
+static inline uint64_t latency_bucket_upper_bound(unsigned index) {
+	if (index < LATENCY_SUB_BUCKETS) {
+		return index;
+	}
+	unsigned exponent = (index >> LATENCY_SUB_BUCKET_BITS) + LATENCY_SUB_BUCKET_BITS - 1;
+	uint64_t sub_bucket = index & (LATENCY_SUB_BUCKETS - 1);
+	uint64_t lower = (LATENCY_SUB_BUCKETS + sub_bucket) << (exponent - LATENCY_SUB_BUCKET_BITS);
+	return lower + (1ull << (exponent - LATENCY_SUB_BUCKET_BITS)) - 1;
+}
+
+static inline void latency_record(latency_histogram_t* histogram, uint64_t value_ns) {
+	_Atomic uint64_t* count = &histogram->counts[latency_bucket_index(value_ns)];
+	// Single writer, so a plain load/store avoids a locked read-modify-write on the hot path
+	atomic_store_explicit(count, atomic_load_explicit(count, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// Total number of samples recorded
+static inline uint64_t latency_count(const latency_histogram_t* histogram) {
+	uint64_t total = 0;
+	for (unsigned i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+		total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+	}
+	return total;
+}
+
+// Upper bound of the bucket holding the given percentile (0-100), or 0 if the histogram is empty
+static inline uint64_t latency_percentile(const latency_histogram_t* histogram, double percentile) {
+	uint64_t total = latency_count(histogram);
+	if (total == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(total * (percentile / 100.0));
+	if (rank >= total) {
+		rank = total - 1;
+	}
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+		seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+		if (seen > rank) {
+			return latency_bucket_upper_bound(i);
+		}
+	}
+	return latency_bucket_upper_bound(LATENCY_NUM_BUCKETS - 1);
+}
+
+static inline uint64_t monotonic_now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#endif // LATENCY_H
@@ -0,0 +1,328 @@
+#ifndef LOG_H
+#define LOG_H
+
+/*
+   Asynchronous logging for the input and output threads.
+
+   stderr goes to the journal under systemd, and a write to it can block on journald, so a flapping device would stall
+   the very thread that should be remapping events. Instead each of those threads formats its messages into its own
+   single-producer ring with snprintf (no I/O, no lock, no allocation) and a logger thread prints them in the background.
+   Messages over LOG_RATE_BURST per second are counted rather than formatted, and the logger folds identical consecutive
+   messages from a thread into a single "repeated N times" line.
+   Threads without a ring (main, or any thread before the logger starts) print synchronously, as before.
+
+   When stderr is the journal (JOURNAL_STREAM, as under g502d.service) the logger sends each message with sd_journal_sendv
+   instead, along with whichever of DEVICE, FD, ERRNO, EVENT_TYPE, EVENT_CODE and EVENT_VALUE it carries, so e.g.
+   `journalctl --user -u g502d DEVICE=keyboard` picks out one device.
+
+   The event trace (--trace, or "trace N" on the control socket) logs one in every N events read from the grabbed devices
+   and written to the virtual ones, with the event's timestamp and how long ago that was, at LOG_DEBUG.
+   It is not rate limited, but whatever doesn't fit in the rings between two drains is dropped (and counted).
+   While it is off, log_trace_events() costs one load and one branch per batch of events.
+*/
+
+#include <inttypes.h>
+#include <linux/input.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <systemd/sd-journal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kb_queue.h"
+
+#define LOG_MESSAGE_MAX 192
+#define LOG_RING_SIZE 64 // Messages, a power of two
+#define LOG_MAX_THREADS 8
+#define LOG_RATE_BURST 20 // Messages per thread per second, beyond which they are only counted
+#define LOG_DRAIN_INTERVAL_NS 100000000ull
+#define LOG_REPEAT_REPORT_NS 10000000000ull // How often a run of repeated messages that hasn't ended yet is summarized,
+                                            // and how long after the last one a message still counts as a repeat
+
+// Structured fields, for the journal
+typedef struct {
+	const char* device; // Must outlive the message (a literal or a static name), NULL if it isn't about a device
+	int fd;             // -1 if none
+	int err;            // errno, 0 if none
+	int type;           // Of an input_event, -1 if none
+	int code;
+	int value;
+} log_fields_t;
+
+static const log_fields_t log_no_fields = { .fd = -1, .type = -1 };
+
+typedef struct {
+	uint64_t time_ns; // CLOCK_REALTIME when logged
+	int priority;     // syslog LOG_ERR, LOG_WARNING, LOG_INFO...
+	bool fold;        // Whether an identical message before it makes this one a repeat, trace records are separate events
+	log_fields_t fields;
+	char message[LOG_MESSAGE_MAX];
+} log_record_t;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head; // Next message to print, written by the logger
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail; // Next message to write, written by the owning thread
+	_Atomic uint64_t dropped;      // Ring full
+	_Atomic uint64_t rate_limited; // Over LOG_RATE_BURST
+	// Owning thread only
+	uint64_t window_start_ns;
+	uint32_t window_count;
+	log_record_t records[LOG_RING_SIZE];
+} log_ring_t;
+
+extern log_ring_t log_rings[LOG_MAX_THREADS];
+extern _Atomic int log_num_rings;
+extern _Atomic bool log_thread_running;
+extern _Thread_local log_ring_t* thread_log_ring;
+extern bool log_to_journal;
+extern _Atomic uint32_t log_trace_every; // 0 while the trace is off
+extern _Thread_local uint32_t log_trace_skipped;
+
+static inline uint64_t log_clock_ns(clockid_t clock) {
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Claim a ring for the calling thread, which keeps logging synchronously if the logger isn't running or all rings are taken
+static inline void log_register_thread(void) {
+	if (!atomic_load(&log_thread_running)) {
+		return;
+	}
+	int index = atomic_fetch_add(&log_num_rings, 1);
+	if (index < LOG_MAX_THREADS) {
+		thread_log_ring = &log_rings[index];
+	}
+}
+
+static inline void log_vwrite(int priority, const log_fields_t* fields, bool rate_limit, const char* format, va_list args) {
+	log_ring_t* ring = thread_log_ring;
+	if (!ring) {
+		vfprintf(stderr, format, args);
+		fputc('\n', stderr);
+		return;
+	}
+
+	if (rate_limit) {
+		uint64_t now_ns = log_clock_ns(CLOCK_MONOTONIC);
+		if (now_ns - ring->window_start_ns >= 1000000000ull) {
+			ring->window_start_ns = now_ns;
+			ring->window_count = 0;
+		}
+		if (ring->window_count >= LOG_RATE_BURST) {
+			atomic_store_explicit(&ring->rate_limited, atomic_load_explicit(&ring->rate_limited, memory_order_relaxed) + 1, memory_order_relaxed);
+			return;
+		}
+		ring->window_count++;
+	}
+
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SIZE) {
+		atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+		return;
+	}
+	log_record_t* record = &ring->records[tail % LOG_RING_SIZE];
+	record->time_ns = log_clock_ns(CLOCK_REALTIME);
+	record->priority = priority;
+	record->fold = rate_limit;
+	record->fields = *fields;
+	vsnprintf(record->message, sizeof(record->message), format, args);
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static inline void log_write(int priority, const log_fields_t* fields, bool rate_limit, const char* format, ...) __attribute__((format(printf, 4, 5)));
+static inline void log_write(int priority, const log_fields_t* fields, bool rate_limit, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	log_vwrite(priority, fields, rate_limit, format, args);
+	va_end(args);
+}
+
+static inline void log_printf(int priority, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static inline void log_printf(int priority, const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	log_vwrite(priority, &log_no_fields, true, format, args);
+	va_end(args);
+}
+
+// About a device, `fd` and `err` are left out of the journal if -1 and 0
+static inline void log_device(int priority, const char* device, int fd, int err, const char* format, ...) __attribute__((format(printf, 5, 6)));
+static inline void log_device(int priority, const char* device, int fd, int err, const char* format, ...) {
+	log_fields_t fields = { .device = device, .fd = fd, .err = err, .type = -1 };
+	va_list args;
+	va_start(args, format);
+	log_vwrite(priority, &fields, true, format, args);
+	va_end(args);
+}
+
+// About an event, e.g. the first of a batch that failed to write
+static inline void log_event(int priority, const char* device, int fd, int err, const struct input_event* ev, const char* format, ...)
+	__attribute__((format(printf, 6, 7)));
+static inline void log_event(int priority, const char* device, int fd, int err, const struct input_event* ev, const char* format, ...) {
+	log_fields_t fields = { .device = device, .fd = fd, .err = err, .type = ev->type, .code = ev->code, .value = ev->value };
+	va_list args;
+	va_start(args, format);
+	log_vwrite(priority, &fields, true, format, args);
+	va_end(args);
+}
+
+static inline __attribute__((cold)) void log_trace_sample(const char* device, const char* stage, const struct input_event* events, size_t count) {
+	uint32_t every = atomic_load_explicit(&log_trace_every, memory_order_relaxed);
+	uint64_t now_us = log_clock_ns(CLOCK_MONOTONIC) / 1000;
+	for (size_t i = 0; i < count; i++) {
+		if (++log_trace_skipped < every) {
+			continue;
+		}
+		log_trace_skipped = 0;
+		const struct input_event* ev = &events[i];
+		uint64_t event_us = (uint64_t)ev->time.tv_sec * 1000000ull + (uint64_t)ev->time.tv_usec;
+		log_fields_t fields = { .device = device, .fd = -1, .type = ev->type, .code = ev->code, .value = ev->value };
+		log_write(LOG_DEBUG, &fields, false, "trace %s %s: type=%u code=%u value=%d time=%" PRIu64 ".%06" PRIu64 " (%" PRId64 " us ago)",
+			stage, device, ev->type, ev->code, ev->value, event_us / 1000000, event_us % 1000000, (int64_t)(now_us - event_us));
+	}
+}
+
+// Trace a batch of events at `stage` ("read" or "write"), one predictable branch while the trace is off
+static inline void log_trace_events(const char* device, const char* stage, const struct input_event* events, size_t count) {
+	if (__builtin_expect(atomic_load_explicit(&log_trace_every, memory_order_relaxed) != 0, 0)) {
+		log_trace_sample(device, stage, events, count);
+	}
+}
+
+// Whether stderr is the journal, JOURNAL_STREAM holds its device and inode numbers then
+static inline bool log_stderr_is_journal(void) {
+	const char* stream = getenv("JOURNAL_STREAM");
+	unsigned long long dev;
+	unsigned long long ino;
+	struct stat st;
+	return stream && sscanf(stream, "%llu:%llu", &dev, &ino) == 2 && fstat(STDERR_FILENO, &st) == 0 &&
+		st.st_dev == dev && st.st_ino == ino;
+}
+
+// Journal fields of one message
+#define LOG_JOURNAL_FIELDS 10
+typedef struct {
+	struct iovec iov[LOG_JOURNAL_FIELDS];
+	char buffers[LOG_JOURNAL_FIELDS][LOG_MESSAGE_MAX + 32];
+	int count;
+} log_journal_entry_t;
+
+static inline void log_journal_field(log_journal_entry_t* entry, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static inline void log_journal_field(log_journal_entry_t* entry, const char* format, ...) {
+	char* buffer = entry->buffers[entry->count];
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(buffer, sizeof(entry->buffers[0]), format, args);
+	va_end(args);
+	entry->iov[entry->count].iov_base = buffer;
+	entry->iov[entry->count].iov_len = length < (int)sizeof(entry->buffers[0]) ? (size_t)length : sizeof(entry->buffers[0]) - 1;
+	entry->count++;
+}
+
+// Print `message` or send it to the journal with the record's priority and fields
+static inline void log_emit(const log_record_t* record, const char* message) {
+	if (!log_to_journal) {
+		fprintf(stderr, "%s\n", message);
+		return;
+	}
+
+	static log_journal_entry_t entry;
+	entry.count = 0;
+	log_journal_field(&entry, "MESSAGE=%s", message);
+	log_journal_field(&entry, "PRIORITY=%d", record->priority);
+	log_journal_field(&entry, "SYSLOG_IDENTIFIER=g502d");
+	// The journal's own timestamp is when the logger got to the message, up to LOG_DRAIN_INTERVAL_NS later
+	log_journal_field(&entry, "LOGGED_USEC=%" PRIu64, record->time_ns / 1000);
+	if (record->fields.device) {
+		log_journal_field(&entry, "DEVICE=%s", record->fields.device);
+	}
+	if (record->fields.fd >= 0) {
+		log_journal_field(&entry, "FD=%d", record->fields.fd);
+	}
+	if (record->fields.err) {
+		log_journal_field(&entry, "ERRNO=%d", record->fields.err);
+	}
+	if (record->fields.type >= 0) {
+		log_journal_field(&entry, "EVENT_TYPE=%d", record->fields.type);
+		log_journal_field(&entry, "EVENT_CODE=%d", record->fields.code);
+		log_journal_field(&entry, "EVENT_VALUE=%d", record->fields.value);
+	}
+	sd_journal_sendv(entry.iov, entry.count);
+}
+
+// What the logger remembers per ring, to fold repeated messages
+typedef struct {
+	log_record_t last;
+	uint64_t last_ns; // When `last` was last logged
+	uint64_t repeats;
+	uint64_t repeats_since_ns;
+	uint64_t dropped;
+	uint64_t rate_limited;
+} log_ring_state_t;
+
+static inline void log_report_repeats(log_ring_state_t* state, uint64_t now_ns) {
+	if (state->repeats) {
+		char message[LOG_MESSAGE_MAX + 32];
+		snprintf(message, sizeof(message), "%s (repeated %" PRIu64 " times)", state->last.message, state->repeats);
+		log_emit(&state->last, message);
+		state->repeats = 0;
+	}
+	state->repeats_since_ns = now_ns;
+}
+
+// Print everything logged since the last call, only ever called from the logger thread
+static inline void log_drain(log_ring_state_t* states) {
+	int count = atomic_load(&log_num_rings);
+	if (count > LOG_MAX_THREADS) {
+		count = LOG_MAX_THREADS;
+	}
+	uint64_t now_ns = log_clock_ns(CLOCK_MONOTONIC);
+	for (int i = 0; i < count; i++) {
+		log_ring_t* ring = &log_rings[i];
+		log_ring_state_t* state = &states[i];
+		uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+		uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		for (; head != tail; head++) {
+			const log_record_t* record = &ring->records[head % LOG_RING_SIZE];
+			if (record->fold && now_ns - state->last_ns < LOG_REPEAT_REPORT_NS && strcmp(record->message, state->last.message) == 0) {
+				if (state->repeats++ == 0) {
+					state->repeats_since_ns = now_ns;
+				}
+				state->last_ns = now_ns;
+				continue;
+			}
+			log_report_repeats(state, now_ns);
+			log_emit(record, record->message);
+			state->last = *record;
+			state->last_ns = now_ns;
+		}
+		atomic_store_explicit(&ring->head, head, memory_order_release);
+
+		if (state->repeats && now_ns - state->repeats_since_ns >= LOG_REPEAT_REPORT_NS) {
+			log_report_repeats(state, now_ns);
+		}
+		uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+		uint64_t rate_limited = atomic_load_explicit(&ring->rate_limited, memory_order_relaxed);
+		if (dropped != state->dropped || rate_limited != state->rate_limited) {
+			char message[LOG_MESSAGE_MAX];
+			snprintf(message, sizeof(message), "Suppressed %" PRIu64 " messages over the rate limit, dropped %" PRIu64 " with the log ring full",
+				rate_limited - state->rate_limited, dropped - state->dropped);
+			log_record_t record = { .priority = LOG_WARNING, .fields = log_no_fields, .time_ns = log_clock_ns(CLOCK_REALTIME) };
+			log_emit(&record, message);
+			state->dropped = dropped;
+			state->rate_limited = rate_limited;
+		}
+	}
+	fflush(stderr);
+}
+
+#endif // LOG_H
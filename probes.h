@@ -0,0 +1,92 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/*
+   USDT probes (provider g502d) at each stage of the pipeline, for bpftrace or SystemTap on a running daemon:
+
+     read     const char* device, type, code, value, event_ns  Events read from a grabbed device
+     remap    type, from, to, target, value, event_ns         Each button the remap tables looked up, and scan codes following one (target is remap_target_t)
+     enqueue  type, code, value, event_ns, source, depth      Events pushed to the keyboard event buffer, depth events ahead of them (source is event_source_t)
+     dequeue  type, code, value, event_ns, source, depth      Events popped from it by the OUTPUT thread, depth events left behind them
+     write    const char* device, type, code, value, event_ns Events written to a virtual device
+
+   event_ns is the evdev timestamp, CLOCK_MONOTONIC like bpftrace's nsecs, so e.g. the latency of every keyboard write is
+     bpftrace -e 'usdt:./g502d:g502d:write { @us[str(arg0)] = hist((nsecs - arg4) / 1000); }'
+
+   Every probe has a semaphore that tracers raise while attached, the arguments are only computed (and the loops over a batch
+   only run) while it is set, so with nothing attached each site is one load and one branch.
+   Without <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel) the probes compile to nothing.
+*/
+
+#include <linux/input.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define G502D_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef G502D_HAVE_SDT
+#define PROBE_SEMAPHORE(name) extern unsigned short g502d_##name##_semaphore;
+#define PROBE_SEMAPHORE_DEFINE(name) unsigned short g502d_##name##_semaphore __attribute__((section(".probes")));
+#define PROBE_ACTIVE(name) __builtin_expect(g502d_##name##_semaphore != 0, 0)
+#else
+#define PROBE_SEMAPHORE(name)
+#define PROBE_SEMAPHORE_DEFINE(name)
+#define PROBE_ACTIVE(name) 0
+#define STAP_PROBE5(provider, name, a1, a2, a3, a4, a5) do {} while (0)
+#define STAP_PROBE6(provider, name, a1, a2, a3, a4, a5, a6) do {} while (0)
+#endif
+
+PROBE_SEMAPHORE(read)
+PROBE_SEMAPHORE(remap)
+PROBE_SEMAPHORE(enqueue)
+PROBE_SEMAPHORE(dequeue)
+PROBE_SEMAPHORE(write)
+
+static inline uint64_t probe_event_ns(const struct input_event* ev) {
+	return (uint64_t)ev->time.tv_sec * 1000000000ull + (uint64_t)ev->time.tv_usec * 1000ull;
+}
+
+static inline void probe_read(const char* device, const struct input_event* events, size_t count) {
+	if (PROBE_ACTIVE(read)) {
+		for (size_t i = 0; i < count; i++) {
+			STAP_PROBE5(g502d, read, device, events[i].type, events[i].code, events[i].value, probe_event_ns(&events[i]));
+		}
+	}
+}
+
+static inline void probe_write(const char* device, const struct input_event* events, size_t count) {
+	if (PROBE_ACTIVE(write)) {
+		for (size_t i = 0; i < count; i++) {
+			STAP_PROBE5(g502d, write, device, events[i].type, events[i].code, events[i].value, probe_event_ns(&events[i]));
+		}
+	}
+}
+
+// `ev` already carries the new code or value
+static inline void probe_remap(const struct input_event* ev, uint32_t from, uint32_t to, int target) {
+	if (PROBE_ACTIVE(remap)) {
+		STAP_PROBE6(g502d, remap, ev->type, from, to, target, ev->value, probe_event_ns(ev));
+	}
+}
+
+// Macros rather than functions so a depth expression is only evaluated while a tracer is attached
+// The depth is kb_queue_depth's, clamped to the capacity, so it never reports a wrapped value
+#define probe_enqueue(ev, source, depth_expr) do { \
+	if (PROBE_ACTIVE(enqueue)) { \
+		STAP_PROBE6(g502d, enqueue, (ev)->type, (ev)->code, (ev)->value, probe_event_ns(ev), (source), (depth_expr)); \
+	} \
+} while (0)
+
+#define probe_dequeue(ev, source, depth_expr) do { \
+	if (PROBE_ACTIVE(dequeue)) { \
+		STAP_PROBE6(g502d, dequeue, (ev)->type, (ev)->code, (ev)->value, probe_event_ns(ev), (source), (depth_expr)); \
+	} \
+} while (0)
+
+#endif // PROBES_H
@@ -0,0 +1,69 @@
+#ifndef RCU_H
+#define RCU_H
+
+/*
+   Minimal read-copy-update for the tables the hot path reads (see input_tables_t in g502d.c).
+
+   Readers never block or take a lock: each one owns a cache-line aligned epoch counter that is odd while it is
+   inside a read-side critical section, so entering and leaving one is two plain stores and a fence.
+   A writer publishes a new pointer, then waits in rcu_synchronize() until every reader that was inside a critical section
+   has left it, after which nothing can still be using the old pointer and it can be freed.
+   Readers blocked in read() between critical sections have an even epoch, so they never hold up a writer.
+*/
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kb_queue.h"
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE) _Atomic uint64_t epoch;
+} rcu_reader_t;
+
+#define RCU_MAX_READERS 8
+extern rcu_reader_t rcu_readers[RCU_MAX_READERS];
+extern _Atomic int rcu_num_readers;
+
+// Claim an epoch counter for the calling thread, returns NULL if there are too many readers
+static inline rcu_reader_t* rcu_register_reader(void) {
+	int index = atomic_fetch_add(&rcu_num_readers, 1);
+	if (index >= RCU_MAX_READERS) {
+		fprintf(stderr, "Too many RCU readers (at most %d)\n", RCU_MAX_READERS);
+		return NULL;
+	}
+	return &rcu_readers[index];
+}
+
+static inline void rcu_read_lock(rcu_reader_t* reader) {
+	uint64_t epoch = atomic_load_explicit(&reader->epoch, memory_order_relaxed);
+	atomic_store_explicit(&reader->epoch, epoch + 1, memory_order_relaxed);
+	// Pairs with the fence in rcu_synchronize: either the writer sees us inside, or we see the new pointer
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void rcu_read_unlock(rcu_reader_t* reader) {
+	uint64_t epoch = atomic_load_explicit(&reader->epoch, memory_order_relaxed);
+	atomic_store_explicit(&reader->epoch, epoch + 1, memory_order_release);
+}
+
+// Wait until no reader can still hold a pointer loaded before the caller published a new one
+static inline void rcu_synchronize(void) {
+	atomic_thread_fence(memory_order_seq_cst);
+	int count = atomic_load(&rcu_num_readers);
+	if (count > RCU_MAX_READERS) {
+		count = RCU_MAX_READERS;
+	}
+	for (int i = 0; i < count; i++) {
+		uint64_t epoch = atomic_load_explicit(&rcu_readers[i].epoch, memory_order_acquire);
+		if (epoch & 1) {
+			// Critical sections only last for one batch of events, so this spins for microseconds at most
+			while (atomic_load_explicit(&rcu_readers[i].epoch, memory_order_acquire) == epoch) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+#endif // RCU_H
@@ -0,0 +1,159 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+/*
+   Recordings of the raw event streams read from the grabbed devices (--record), and reading them back (--replay).
+
+   A recording is a header followed by one fixed-size record per input_event, in host byte order.
+   Records keep the time since the previous record instead of a full timeval, so they take 16 bytes rather than 24,
+   and the replayer rebuilds the timestamps from a base of its choosing with the recorded spacing.
+*/
+
+#include <errno.h>
+#include <linux/input.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define RECORD_MAGIC   "G502REC" // 8 bytes with the NUL
+#define RECORD_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size; // sizeof(event_record_t), so recordings from another architecture are rejected
+} record_header_t;
+
+typedef struct {
+	uint32_t delta_us; // Since the previous record, saturating so a gap of over 71 minutes is shortened
+	uint8_t device;    // input_device_id_t
+	uint8_t index;     // Which device of that kind, in config file order
+	uint16_t type;
+	uint16_t code;
+	uint16_t reserved;
+	int32_t value;
+} event_record_t;
+
+typedef struct {
+	FILE* file;
+	uint64_t last_us; // Newest event timestamp written, 0 before the first
+	_Atomic bool stopped; // A write failed, nothing more is recorded
+} event_recorder_t;
+
+typedef struct {
+	FILE* file;
+	uint64_t time_us; // Rebuilt timestamp of the last record read
+} event_replayer_t;
+
+static inline uint64_t record_event_time_us(const struct input_event* ev) {
+	return (uint64_t)ev->time.tv_sec * 1000000ull + (uint64_t)ev->time.tv_usec;
+}
+
+// Create (or truncate) a recording, returns 0 on success
+static inline int recorder_open(event_recorder_t* recorder, const char* path) {
+	recorder->file = fopen(path, "wb");
+	recorder->last_us = 0;
+	atomic_store(&recorder->stopped, false);
+	if (!recorder->file) {
+		fprintf(stderr, "Failed to create recording %s\n", path);
+		return -1;
+	}
+	record_header_t header = { .version = RECORD_VERSION, .record_size = sizeof(event_record_t) };
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	if (fwrite(&header, sizeof(header), 1, recorder->file) != 1 || fflush(recorder->file) != 0) {
+		fprintf(stderr, "Failed to write recording %s\n", path);
+		fclose(recorder->file);
+		recorder->file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// Append a batch of events read from one device, safe to call from several threads
+// Flushed after every batch so the recording is complete whenever the daemon is killed
+// Returns -1 with errno set from the call whose write failed (e.g. a full disk), the recorder is stopped from then on and later calls do nothing
+static inline int recorder_write(event_recorder_t* recorder, uint8_t device, uint8_t index, const struct input_event* events, size_t count) {
+	if (atomic_load_explicit(&recorder->stopped, memory_order_relaxed)) {
+		return 0;
+	}
+	flockfile(recorder->file);
+	if (atomic_load_explicit(&recorder->stopped, memory_order_relaxed)) {
+		funlockfile(recorder->file);
+		return 0;
+	}
+	bool failed = false;
+	for (size_t i = 0; i < count && !failed; i++) {
+		// Threads race to take the lock, a batch read slightly earlier but written later gets a delta of 0
+		uint64_t time_us = record_event_time_us(&events[i]);
+		uint64_t delta_us = recorder->last_us && time_us > recorder->last_us ? time_us - recorder->last_us : 0;
+		if (time_us > recorder->last_us) {
+			recorder->last_us = time_us;
+		}
+		event_record_t record = {
+			.delta_us = delta_us > UINT32_MAX ? UINT32_MAX : (uint32_t)delta_us,
+			.device = device,
+			.index = index,
+			.type = events[i].type,
+			.code = events[i].code,
+			.value = events[i].value,
+		};
+		failed = fwrite_unlocked(&record, sizeof(record), 1, recorder->file) != 1;
+	}
+	failed = fflush_unlocked(recorder->file) != 0 || failed;
+	int err = errno;
+	if (failed) {
+		atomic_store_explicit(&recorder->stopped, true, memory_order_relaxed);
+	}
+	funlockfile(recorder->file);
+	errno = err;
+	return failed ? -1 : 0;
+}
+
+// Open a recording for replay, the first event is timestamped `start_us`, returns 0 on success
+static inline int replayer_open(event_replayer_t* replayer, const char* path, uint64_t start_us) {
+	replayer->file = fopen(path, "rb");
+	replayer->time_us = start_us;
+	if (!replayer->file) {
+		fprintf(stderr, "Failed to open recording %s\n", path);
+		return -1;
+	}
+	record_header_t header;
+	if (fread(&header, sizeof(header), 1, replayer->file) != 1 || memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != RECORD_VERSION || header.record_size != sizeof(event_record_t)) {
+		fprintf(stderr, "%s is not a g502d recording, or was made by an incompatible version\n", path);
+		fclose(replayer->file);
+		replayer->file = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// Read the next event with its timestamp rebuilt
+// Returns 1, or 0 at the end of the recording (a truncated last record is ignored)
+static inline int replayer_next(event_replayer_t* replayer, struct input_event* ev, uint8_t* device, uint8_t* index) {
+	event_record_t record;
+	if (fread(&record, sizeof(record), 1, replayer->file) != 1) {
+		return 0;
+	}
+	replayer->time_us += record.delta_us;
+	memset(ev, 0, sizeof(*ev));
+	ev->time.tv_sec = replayer->time_us / 1000000;
+	ev->time.tv_usec = replayer->time_us % 1000000;
+	ev->type = record.type;
+	ev->code = record.code;
+	ev->value = record.value;
+	*device = record.device;
+	*index = record.index;
+	return 1;
+}
+
+static inline void replayer_close(event_replayer_t* replayer) {
+	if (replayer->file) {
+		fclose(replayer->file);
+		replayer->file = NULL;
+	}
+}
+
+#endif // RECORD_H
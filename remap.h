@@ -0,0 +1,122 @@
+#ifndef REMAP_H
+#define REMAP_H
+
+/*
+   Remap tables for mouse buttons and their MSC_SCAN codes, built at startup from the config file (see config_file.h).
+
+   Buttons are a flat array indexed by key code, so remapping an EV_KEY event is a single array load.
+   Scan codes are sparse 32-bit values, so they live in a small open table with a multiplicative perfect hash:
+   the multiplier is searched for at build time until no two configured codes share a slot,
+   then a lookup is a multiply, a shift and one compare.
+*/
+
+#include <linux/input.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Where a remapped button goes
+typedef enum {
+	REMAP_TARGET_MOUSE,    // Virtual G502
+	REMAP_TARGET_KEYBOARD, // Virtual keyboard
+} remap_target_t;
+
+typedef struct {
+	uint16_t code;
+	uint8_t target; // remap_target_t
+} key_remap_t;
+
+#define SCAN_REMAP_MAX  32
+#define SCAN_REMAP_BITS 7 // Twice SCAN_REMAP_MAX rounded up, so a collision-free multiplier is quick to find
+#define SCAN_REMAP_SLOTS (1u << SCAN_REMAP_BITS)
+#define SCAN_REMAP_MAX_TRIES (1u << 20)
+
+typedef struct {
+	uint32_t from;
+	uint32_t to;
+	bool used;
+} scan_remap_slot_t;
+
+typedef struct {
+	uint32_t multiplier;
+	scan_remap_slot_t slots[SCAN_REMAP_SLOTS];
+} scan_remap_table_t;
+
+typedef struct {
+	key_remap_t keys[KEY_CNT];
+	scan_remap_table_t scans;
+} remap_tables_t;
+
+// Identity mapping, every button stays on the virtual G502 and no scan code is remapped
+static inline void remap_tables_init(remap_tables_t* tables) {
+	for (unsigned code = 0; code < KEY_CNT; code++) {
+		tables->keys[code].code = code;
+		tables->keys[code].target = REMAP_TARGET_MOUSE;
+	}
+	memset(&tables->scans, 0, sizeof(tables->scans));
+}
+
+// Keyboard keys go to the virtual keyboard, mouse buttons (e.g. swapping two buttons) stay on the virtual G502
+static inline void remap_tables_set_key(remap_tables_t* tables, uint16_t from, uint16_t to) {
+	tables->keys[from].code = to;
+	tables->keys[from].target = (to >= BTN_MOUSE && to < BTN_JOYSTICK) ? REMAP_TARGET_MOUSE : REMAP_TARGET_KEYBOARD;
+}
+
+static inline const key_remap_t* remap_key(const remap_tables_t* tables, uint16_t code) {
+	return &tables->keys[code < KEY_CNT ? code : 0];
+}
+
+static inline unsigned scan_remap_index(uint32_t multiplier, uint32_t scan) {
+	return (uint32_t)(scan * multiplier) >> (32 - SCAN_REMAP_BITS);
+}
+
+// Build the scan code table from `count` (from, to) pairs, `from` values must be unique
+// Returns 0 on success, or -1 if there are too many codes or no collision-free multiplier was found
+static inline int scan_remap_build(scan_remap_table_t* table, const uint32_t (*pairs)[2], size_t count) {
+	memset(table, 0, sizeof(*table));
+	if (count > SCAN_REMAP_MAX) {
+		fprintf(stderr, "Too many scan code remaps (%zu, at most %d)\n", count, SCAN_REMAP_MAX);
+		return -1;
+	}
+
+	uint32_t multiplier = 0x9e3779b1; // Golden ratio, usually collision-free straight away for a handful of nearby codes
+	for (uint32_t attempt = 0; attempt < SCAN_REMAP_MAX_TRIES; attempt++) {
+		uint8_t taken[SCAN_REMAP_SLOTS] = {0};
+		size_t i;
+		for (i = 0; i < count; i++) {
+			unsigned index = scan_remap_index(multiplier, pairs[i][0]);
+			if (taken[index]) {
+				break;
+			}
+			taken[index] = 1;
+		}
+		if (i == count) {
+			table->multiplier = multiplier;
+			for (i = 0; i < count; i++) {
+				scan_remap_slot_t* slot = &table->slots[scan_remap_index(multiplier, pairs[i][0])];
+				slot->from = pairs[i][0];
+				slot->to = pairs[i][1];
+				slot->used = true;
+			}
+			return 0;
+		}
+		// Next odd multiplier from a simple LCG
+		multiplier = (multiplier * 1664525u + 1013904223u) | 1;
+	}
+
+	fprintf(stderr, "Failed to find a perfect hash for %zu scan code remaps\n", count);
+	return -1;
+}
+
+// Returns true and sets `to` if the scan code is remapped
+static inline bool remap_scan(const remap_tables_t* tables, uint32_t scan, uint32_t* to) {
+	const scan_remap_slot_t* slot = &tables->scans.slots[scan_remap_index(tables->scans.multiplier, scan)];
+	if (slot->used && slot->from == scan) {
+		*to = slot->to;
+		return true;
+	}
+	return false;
+}
+
+#endif // REMAP_H
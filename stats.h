@@ -0,0 +1,122 @@
+#ifndef STATS_H
+#define STATS_H
+
+/*
+   Per-thread counters for the stats socket and --stats.
+
+   Every thread that touches the hot path registers its own cache-line aligned block, and only ever writes to that block,
+   so incrementing a counter is a plain load/store with no locked instruction and no cache line shared between threads.
+   Readers sum (or take the max of) the blocks of all threads, and may see slightly stale values.
+*/
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "kb_queue.h"
+
+// Grabbed input devices
+typedef enum {
+	INPUT_DEVICE_MOUSE,
+	INPUT_DEVICE_KEYBOARD,
+	NUM_INPUT_DEVICES,
+} input_device_id_t;
+
+static const char* const input_device_names[NUM_INPUT_DEVICES] = { "mouse", "keyboard" };
+
+// Virtual uinput devices
+typedef enum {
+	VIRTUAL_DEVICE_G502,
+	VIRTUAL_DEVICE_KEYBOARD,
+	NUM_VIRTUAL_DEVICES,
+} virtual_device_id_t;
+
+typedef struct {
+	_Atomic uint64_t events;   // Events transferred
+	_Atomic uint64_t bytes;    // Bytes transferred
+	_Atomic uint64_t calls;    // read()/write() syscalls, or io_uring operations
+	_Atomic uint64_t failures; // Calls that failed or transferred less than asked
+} io_counters_t;
+
+typedef struct {
+	_Alignas(CACHE_LINE_SIZE)
+	io_counters_t reads[NUM_INPUT_DEVICES];
+	io_counters_t writes[NUM_VIRTUAL_DEVICES];
+	_Atomic uint64_t reconnects[NUM_INPUT_DEVICES];
+	_Atomic uint64_t kb_queue_high_water; // Gauge, maximum depth of the keyboard event buffer after a push by this thread
+	_Atomic uint64_t kb_syn_skipped; // Mouse SYN_REPORTs not forwarded to the keyboard as the frame had no keyboard events
+	_Atomic uint64_t kb_overflow_waits;     // Times a producer found the keyboard event buffer full and waited
+	_Atomic uint64_t kb_overflow_dropped;   // Keyboard events dropped by KB_OVERFLOW_DROP_OLDEST
+	_Atomic uint64_t kb_overflow_coalesced; // Key repeats dropped by KB_OVERFLOW_COALESCE
+} thread_stats_t;
+
+#define MAX_STATS_THREADS 8
+extern thread_stats_t all_thread_stats[MAX_STATS_THREADS];
+extern _Atomic int num_thread_stats;
+extern _Thread_local thread_stats_t* thread_stats;
+
+// Single writer, so a plain load/store avoids a locked read-modify-write on the hot path
+static inline void stats_add(_Atomic uint64_t* counter, uint64_t amount) {
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static inline void stats_max(_Atomic uint64_t* gauge, uint64_t value) {
+	if (value > atomic_load_explicit(gauge, memory_order_relaxed)) {
+		atomic_store_explicit(gauge, value, memory_order_relaxed);
+	}
+}
+
+// Account for one read()/write() call that returned `result` bytes of input_events
+static inline void stats_count_io(io_counters_t* counters, ssize_t result, int failed) {
+	stats_add(&counters->calls, 1);
+	if (result > 0) {
+		stats_add(&counters->bytes, (uint64_t)result);
+		stats_add(&counters->events, (uint64_t)result / sizeof(struct input_event));
+	}
+	if (failed) {
+		stats_add(&counters->failures, 1);
+	}
+}
+
+// Claim a counter block for the calling thread, must be called before the thread touches any counter
+static inline void stats_register_thread(void) {
+	int index = atomic_fetch_add(&num_thread_stats, 1);
+	if (index >= MAX_STATS_THREADS) {
+		// Share the last block rather than fail, counts may then be slightly off
+		index = MAX_STATS_THREADS - 1;
+	}
+	thread_stats = &all_thread_stats[index];
+}
+
+// Sum a counter over all threads, `offset` is the offsetof() the counter within thread_stats_t
+static inline uint64_t stats_sum(size_t offset) {
+	int count = atomic_load(&num_thread_stats);
+	if (count > MAX_STATS_THREADS) {
+		count = MAX_STATS_THREADS;
+	}
+	uint64_t total = 0;
+	for (int i = 0; i < count; i++) {
+		_Atomic uint64_t* counter = (_Atomic uint64_t*)((char*)&all_thread_stats[i] + offset);
+		total += atomic_load_explicit(counter, memory_order_relaxed);
+	}
+	return total;
+}
+
+static inline uint64_t stats_max_over_threads(size_t offset) {
+	int count = atomic_load(&num_thread_stats);
+	if (count > MAX_STATS_THREADS) {
+		count = MAX_STATS_THREADS;
+	}
+	uint64_t max = 0;
+	for (int i = 0; i < count; i++) {
+		_Atomic uint64_t* gauge = (_Atomic uint64_t*)((char*)&all_thread_stats[i] + offset);
+		uint64_t value = atomic_load_explicit(gauge, memory_order_relaxed);
+		if (value > max) {
+			max = value;
+		}
+	}
+	return max;
+}
+
+#endif // STATS_H
@@ -0,0 +1,177 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+   Minimal io_uring wrapper over the raw syscalls, just enough for the io_uring backend (--io-uring).
+   Only a single thread may use a ring.
+
+   Using the kernel interface directly avoids a liburing dependency, and io_uring_setup failing
+   (old kernel, seccomp, io_uring_disabled sysctl) is the signal to fall back to the read/write path.
+
+   The grabbed evdev fds must be O_NONBLOCK. evdev has no read_iter, so on a blocking fd io_uring can't attempt a read
+   without risking a sleep: after the first poll wakeup every IORING_OP_READ is handed to an io-wq worker thread,
+   adding a kernel thread handoff to each report. O_NONBLOCK tells it the read can be tried inline, so a read waits on
+   poll and completes directly from the wakeup. The hotplug eventfd supports non-blocking attempts itself, so it is left blocking.
+*/
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef struct {
+	int fd;
+
+	// Submission queue, shared with the kernel
+	unsigned* sq_head;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	struct io_uring_sqe* sqes;
+	unsigned sqe_tail;   // SQEs handed out by uring_get_sqe
+	unsigned sqe_head;   // SQEs already published to the kernel
+
+	// Completion queue, shared with the kernel
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe* cqes;
+
+	void* sq_ptr;
+	size_t sq_size;
+	void* cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+} uring_t;
+
+// Set up a ring with room for at least `entries` submissions
+// Returns 0 on success or a negative errno
+static inline int uring_init(uring_t* ring, unsigned entries) {
+	memset(ring, 0, sizeof(*ring));
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) {
+		return -errno;
+	}
+	ring->fd = fd;
+
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_size > ring->sq_size) {
+			ring->sq_size = ring->cq_size;
+		}
+		ring->cq_size = ring->sq_size;
+	}
+
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		int err = errno;
+		close(fd);
+		return -err;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			int err = errno;
+			munmap(ring->sq_ptr, ring->sq_size);
+			close(fd);
+			return -err;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		int err = errno;
+		if (ring->cq_ptr != ring->sq_ptr) {
+			munmap(ring->cq_ptr, ring->cq_size);
+		}
+		munmap(ring->sq_ptr, ring->sq_size);
+		close(fd);
+		return -err;
+	}
+
+	char* sq = ring->sq_ptr;
+	ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+	ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+
+	char* cq = ring->cq_ptr;
+	ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	// SQEs are always handed out in order, so the index array is an identity mapping
+	for (unsigned i = 0; i <= ring->sq_mask; i++) {
+		ring->sq_array[i] = i;
+	}
+
+	return 0;
+}
+
+static inline void uring_exit(uring_t* ring) {
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+// Get a zeroed SQE to fill in, or NULL if the submission queue is full
+static inline struct io_uring_sqe* uring_get_sqe(uring_t* ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head > ring->sq_mask) {
+		return NULL;
+	}
+	struct io_uring_sqe* sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+	ring->sqe_tail++;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+static inline void uring_prep_rw(struct io_uring_sqe* sqe, uint8_t opcode, int fd, void* buf, unsigned len, uint64_t user_data) {
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->off = (uint64_t)-1; // Use (and advance) the file position, like read()/write()
+	sqe->user_data = user_data;
+}
+
+// Publish queued SQEs and wait for at least `wait_nr` completions, all in a single syscall
+// Returns the number of SQEs submitted or a negative errno
+static inline int uring_submit_and_wait(uring_t* ring, unsigned wait_nr) {
+	unsigned to_submit = ring->sqe_tail - ring->sqe_head;
+	if (to_submit) {
+		__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+		ring->sqe_head = ring->sqe_tail;
+	}
+	unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+	int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, NULL, 0);
+	return ret < 0 ? -errno : ret;
+}
+
+// Copy out the next completion, returns false if there is none
+static inline bool uring_pop_cqe(uring_t* ring, struct io_uring_cqe* cqe) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+	*cqe = ring->cqes[head & ring->cq_mask];
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+#endif // URING_H